@@ -0,0 +1,250 @@
+// string_trie: A C++ Patricia trie implementation for strings.
+// Copyright (C) 2013 Darren Mo
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _CONCURRENT_STRING_TRIE_H_
+#define _CONCURRENT_STRING_TRIE_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iterator>
+#include <utility>
+
+#include "string_trie.hpp"
+
+
+/* Template declarations */
+
+template<typename charT, charT reservedChar, bool binaryKeys = false> class concurrent_string_trie;
+template<typename charT, charT reservedChar, bool binaryKeys> class concurrent_string_trie_snapshot;
+template<typename charT, charT reservedChar, bool binaryKeys> class concurrent_string_trie_const_iterator;
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator==(const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2);
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator!=(const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2);
+
+// Like binary_string_trie, a concurrent trie whose strings may be empty and may contain any character
+template<typename charT> using binary_concurrent_string_trie = concurrent_string_trie<charT, charT(0), true>;
+
+
+/* Concurrent string trie class */
+
+// A trie that any number of threads can read while one thread at a time writes. Nodes are never changed once
+// published: insert() and remove() copy the nodes on the path to the string and then swap in the new root, so a reader
+// keeps a consistent snapshot for as long as it holds one. Replaced roots are freed once no reader can still be using
+// them. Nodes are reference counted, so copies of a trie share every node they have in common and copying is O(1).
+// Strings are kept in std::basic_string order, and follow the same rules as string_trie's.
+template<typename charT, charT reservedChar, bool binaryKeys>
+class concurrent_string_trie {
+public:
+	typedef concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys> snapshot;
+	
+	
+	concurrent_string_trie();
+	concurrent_string_trie(const concurrent_string_trie& otherTrie);
+	
+	~concurrent_string_trie();  // must not overlap with any other use of the trie, including open snapshots
+	
+	concurrent_string_trie& operator=(const concurrent_string_trie& otherTrie);
+	
+	
+	/* The following are safe to call from any thread at any time. Writers wait for each other but never for readers. */
+	
+	snapshot read() const;  // lock-free; the snapshot's iterators are valid until it is destroyed
+	
+	void clear();
+	bool empty() const;
+	size_t size() const;
+	
+	
+	/* The following throw std::invalid_argument if string contains reservedChar or is empty, unless binaryKeys is set.
+	   Only insert() copies string, into the new leaf. */
+	
+	void insert(std::basic_string_view<charT> string);
+	void remove(std::basic_string_view<charT> string);
+	
+	bool contains(std::basic_string_view<charT> string) const;  // same as read().contains(string)
+	
+	
+	// Waits for the readers that might still be using replaced nodes and frees those nodes. Writers free them anyway as
+	// readers finish, so this is only needed to get memory back sooner. Deadlocks if this thread holds a snapshot.
+	void synchronize();
+
+private:
+	friend class concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>;
+	friend class concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>;
+	friend class string_trie_path<concurrent_string_trie, charT>;
+	
+	
+	struct node;
+	struct leaf_node;
+	struct inner_node;
+	
+	struct path_entry {
+		const inner_node* node;
+		unsigned index;  // of the child we went down to, or terminalIndex for the terminal leaf
+	};
+	
+	static const unsigned terminalIndex = ~0u;
+	
+	// Readers announce themselves in one of two counters, chosen by the parity of the epoch. Threads are spread over
+	// several stripes so that readers on different cores rarely touch the same cache line.
+	struct alignas(64) reader_stripe {
+		std::atomic<long> readers[2];
+	};
+	
+	static const unsigned numStripes = 16;
+	
+	
+	std::atomic<const node*> root_;
+	std::atomic<size_t> size_;
+	
+	mutable std::atomic<unsigned> epoch_;
+	mutable reader_stripe stripes_[numStripes];
+	
+	mutable std::mutex writerMutex_;
+	std::vector<std::pair<const node*, unsigned>> retired_;  // replaced roots, oldest first, and the epoch they were replaced in
+	
+	
+	std::pair<unsigned, unsigned> enterReader() const;
+	void exitReader(std::pair<unsigned, unsigned> slot) const;
+	
+	void publish(const node* root);
+	bool advanceEpoch();
+	
+	const node* searchPath(std::basic_string_view<charT> string, std::vector<path_entry>& path) const;
+	const node* copyPath(const std::vector<path_entry>& path, size_t depth, const node* replacement);
+	
+	static leaf_node* newLeafNode(std::basic_string_view<charT> string);
+	static inner_node* newInnerNode(unsigned numChildren, typename std::basic_string<charT>::size_type compareIndex);
+	static inner_node* copyInnerNode(const inner_node& otherNode, unsigned index, const node* child, bool insertChild, charT character);
+	
+	static void retain(const node* node);
+	static void release(const node* node);
+	
+	static const charT* keyOf(const leaf_node& leaf);
+	static const leaf_node& representativeOf(const node& node);
+	static const node* childTowards(const inner_node& inner, std::basic_string_view<charT> string);
+	static typename std::basic_string<charT>::size_type indexOfFirstDifference(std::basic_string_view<charT> string, const node& node);
+	static unsigned stripeOfThisThread();
+	
+	static void validateString(std::basic_string_view<charT> string);
+};
+
+
+/* Snapshots */
+
+// A consistent view of the trie as it was when the snapshot was taken. Nothing it can reach is freed while it exists.
+template<typename charT, charT reservedChar, bool binaryKeys>
+class concurrent_string_trie_snapshot {
+	friend class concurrent_string_trie<charT, reservedChar, binaryKeys>;
+
+public:
+	typedef concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys> const_iterator;
+	typedef string_trie_reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef string_trie_range<const_iterator> const_range;
+	
+	
+	concurrent_string_trie_snapshot(concurrent_string_trie_snapshot&& otherSnapshot);
+	
+	~concurrent_string_trie_snapshot();
+	
+	
+	const_iterator cbegin() const;
+	const_iterator cend() const;
+	const_reverse_iterator crbegin() const;
+	const_reverse_iterator crend() const;
+	
+	bool empty() const;
+	
+	
+	/* The following throw std::invalid_argument if string contains reservedChar or is empty, unless binaryKeys is set.
+	   None of them copy string. */
+	
+	bool contains(std::basic_string_view<charT> string) const;
+	
+	const_iterator predecessor(std::basic_string_view<charT> string) const;
+	const_iterator successor(std::basic_string_view<charT> string) const;
+	
+	const_range prefixedStrings(std::basic_string_view<charT> prefix) const;
+
+private:
+	typedef typename concurrent_string_trie<charT, reservedChar, binaryKeys>::node node;
+	typedef typename concurrent_string_trie<charT, reservedChar, binaryKeys>::leaf_node leaf_node;
+	typedef typename concurrent_string_trie<charT, reservedChar, binaryKeys>::inner_node inner_node;
+	
+	
+	const concurrent_string_trie<charT, reservedChar, binaryKeys>* trie_;  // nullptr once moved from
+	std::pair<unsigned, unsigned> slot_;  // stripe and parity the reader is counted in
+	
+	const node* root_;
+	
+	
+	concurrent_string_trie_snapshot(const concurrent_string_trie<charT, reservedChar, binaryKeys>& trie);
+	
+	concurrent_string_trie_snapshot(const concurrent_string_trie_snapshot& otherSnapshot);
+	
+	concurrent_string_trie_snapshot& operator=(const concurrent_string_trie_snapshot& otherSnapshot);
+	
+	
+	const_iterator lowerBound(std::basic_string_view<charT> string, bool strict) const;
+};
+
+
+/* Concurrent string trie iterators */
+
+// Walks the nodes like string_trie's iterators. Nodes of a snapshot never change, so the path stays valid for as long
+// as the snapshot exists.
+template<typename charT, charT reservedChar, bool binaryKeys>
+class concurrent_string_trie_const_iterator : public string_trie_path<concurrent_string_trie<charT, reservedChar, binaryKeys>, charT> {
+	friend class concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>;
+	
+	friend bool operator==<>(const typename concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::const_iterator& iterator1, const typename concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::const_iterator& iterator2);
+	
+	friend bool operator!=<>(const typename concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::const_iterator& iterator1, const typename concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::const_iterator& iterator2);
+
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef std::basic_string<charT> value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef string_trie_key_view<charT> reference;
+	
+	
+	concurrent_string_trie_const_iterator();
+	
+	reference operator*() const;
+	concurrent_string_trie_const_iterator& operator++();
+	concurrent_string_trie_const_iterator operator++(int i);
+	concurrent_string_trie_const_iterator& operator--();
+	concurrent_string_trie_const_iterator operator--(int i);
+
+private:
+	typedef typename concurrent_string_trie<charT, reservedChar, binaryKeys>::node node;
+	
+	
+	concurrent_string_trie_const_iterator(const concurrent_string_trie<charT, reservedChar, binaryKeys>& trie, const node* root);
+};
+
+
+#include "concurrent_string_trie.tpp"
+
+#endif
@@ -0,0 +1,817 @@
+// string_trie: A C++ Patricia trie implementation for strings.
+// Copyright (C) 2013 Darren Mo
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+
+/* Nodes */
+
+// Nodes are immutable once published, apart from their reference count: the number of parents and trie roots that
+// point at them, across every trie sharing them.
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct concurrent_string_trie<charT, reservedChar, binaryKeys>::node {
+	mutable std::atomic<unsigned> references;
+	const bool leaf;
+	
+	
+	explicit node(bool leaf) : references(1), leaf(leaf) {}
+	
+	
+	bool isLeaf() const {
+		return leaf;
+	}
+};
+
+// The key follows the node in the same allocation. Each leaf is allocated on its own, so any length fits.
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct concurrent_string_trie<charT, reservedChar, binaryKeys>::leaf_node : node {
+	size_t length;
+	
+	
+	explicit leaf_node(size_t length) : node(true), length(length) {}
+	
+	
+	charT* key() {
+		return reinterpret_cast<charT*>(this + 1);
+	}
+	
+	const charT* key() const {
+		return reinterpret_cast<const charT*>(this + 1);
+	}
+	
+	
+	static size_t allocationSize(size_t length) {
+		return sizeof(leaf_node) + length * sizeof(charT);
+	}
+};
+
+// The children, then their characters in order, follow the node in the same allocation. As in string_trie, a key that
+// ends exactly at compareIndex is the node's terminal leaf, which sorts before every child and is its representative.
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct concurrent_string_trie<charT, reservedChar, binaryKeys>::inner_node : node {
+	bool hasTerminal;  // the node holds a reference to its representative
+	unsigned numChildren;  // not counting the terminal leaf
+	typename std::basic_string<charT>::size_type compareIndex;
+	const leaf_node* representative;
+	
+	
+	inner_node(unsigned numChildren, typename std::basic_string<charT>::size_type compareIndex) : node(false), hasTerminal(false), numChildren(numChildren), compareIndex(compareIndex), representative(nullptr) {}
+	
+	
+	const node** children() {
+		return reinterpret_cast<const node**>(this + 1);
+	}
+	
+	const node* const* children() const {
+		return reinterpret_cast<const node* const*>(this + 1);
+	}
+	
+	charT* characters() {
+		return reinterpret_cast<charT*>(children() + numChildren);
+	}
+	
+	const charT* characters() const {
+		return reinterpret_cast<const charT*>(children() + numChildren);
+	}
+	
+	
+	const node* terminal() const {
+		return hasTerminal ? representative : nullptr;
+	}
+	
+	unsigned numBranches() const {
+		return numChildren + hasTerminal;
+	}
+	
+	// The child at index, or the terminal leaf for terminalIndex
+	const node* branch(unsigned index) const {
+		return index == terminalIndex ? terminal() : children()[index];
+	}
+	
+	
+	// Sets index to where the child for character is, or would be inserted
+	bool find(charT character, unsigned& index) const {
+		const charT* first = characters();
+		const charT* i = std::lower_bound(first, first + numChildren, character, less);
+		
+		index = static_cast<unsigned>(i - first);
+		
+		return index < numChildren && *i == character;
+	}
+	
+	// Returns the slot holding the child for character, or nullptr if there is none
+	const node* const* find(charT character) const {
+		unsigned index;
+		
+		return find(character, index) ? children() + index : nullptr;
+	}
+	
+	// Each of these also sets character to the returned child's character
+	const node* firstChild(charT& character) const {
+		return childAt(0, character);
+	}
+	
+	const node* lastChild(charT& character) const {
+		return childAt(numChildren - 1, character);
+	}
+	
+	const node* nextChild(charT& character) const {  // first child whose character is greater than character
+		unsigned index;
+		
+		return childAt(find(character, index) ? index + 1 : index, character);
+	}
+	
+	const node* previousChild(charT& character) const {  // last child whose character is less than character
+		unsigned index;
+		find(character, index);
+		
+		return childAt(index - 1, character);
+	}
+	
+	
+	// Children are ordered like the characters of std::basic_string
+	static bool less(charT character1, charT character2) {
+		return std::char_traits<charT>::lt(character1, character2);
+	}
+	
+	static size_t allocationSize(unsigned numChildren) {
+		return sizeof(inner_node) + numChildren * (sizeof(node*) + sizeof(charT));
+	}
+
+private:
+	const node* childAt(unsigned index, charT& character) const {
+		if (index >= numChildren) return nullptr;  // including an index that wrapped below 0
+		
+		character = characters()[index];
+		
+		return children()[index];
+	}
+};
+
+
+/* concurrent_string_trie_const_iterator */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::concurrent_string_trie_const_iterator() {
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::concurrent_string_trie_const_iterator(const concurrent_string_trie<charT, reservedChar, binaryKeys>& trie, const node* root) : string_trie_path<concurrent_string_trie<charT, reservedChar, binaryKeys>, charT>(trie, root) {
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator*() const -> reference {
+	return this->key();
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator++() {
+	this->stepForward();
+	
+	return *this;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys> concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator++(int i) {
+	concurrent_string_trie_const_iterator tmp = *this;
+	
+	++*this;
+	
+	return tmp;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator--() {
+	this->stepBack();
+	
+	return *this;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys> concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator--(int i) {
+	concurrent_string_trie_const_iterator tmp = *this;
+	
+	--*this;
+	
+	return tmp;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator==(const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2) {
+	return iterator1.root_ == iterator2.root_ && iterator1.leaf_ == iterator2.leaf_;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator!=(const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const concurrent_string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2) {
+	return !(iterator1 == iterator2);
+}
+
+
+/* concurrent_string_trie_snapshot */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::concurrent_string_trie_snapshot(const concurrent_string_trie<charT, reservedChar, binaryKeys>& trie) : trie_(&trie), slot_(trie.enterReader()), root_(trie.root_.load()) {
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::concurrent_string_trie_snapshot(concurrent_string_trie_snapshot&& otherSnapshot) : trie_(otherSnapshot.trie_), slot_(otherSnapshot.slot_), root_(otherSnapshot.root_) {
+	otherSnapshot.trie_ = nullptr;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::~concurrent_string_trie_snapshot() {
+	if (trie_) trie_->exitReader(slot_);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::cbegin() const -> const_iterator {
+	return ++cend();
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::cend() const -> const_iterator {
+	return const_iterator(*trie_, root_);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::crbegin() const -> const_reverse_iterator {
+	return const_reverse_iterator(--cend());
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::crend() const -> const_reverse_iterator {
+	return const_reverse_iterator(cend());
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::empty() const {
+	return !root_;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::contains(std::basic_string_view<charT> string) const {
+	concurrent_string_trie<charT, reservedChar, binaryKeys>::validateString(string);
+	
+	
+	const node* node = root_;
+	
+	while (node && !node->isLeaf()) {
+		node = concurrent_string_trie<charT, reservedChar, binaryKeys>::childTowards(*static_cast<const inner_node*>(node), string);
+	}
+	
+	return node && concurrent_string_trie<charT, reservedChar, binaryKeys>::indexOfFirstDifference(string, *node) == std::basic_string<charT>::npos;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::predecessor(std::basic_string_view<charT> string) const -> const_iterator {
+	concurrent_string_trie<charT, reservedChar, binaryKeys>::validateString(string);
+	
+	
+	// Stepping back from the first string gives the past-the-end iterator
+	return --lowerBound(string, false);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::successor(std::basic_string_view<charT> string) const -> const_iterator {
+	concurrent_string_trie<charT, reservedChar, binaryKeys>::validateString(string);
+	
+	
+	return lowerBound(string, true);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::prefixedStrings(std::basic_string_view<charT> prefix) const -> const_range {
+	concurrent_string_trie<charT, reservedChar, binaryKeys>::validateString(prefix);
+	
+	
+	const_iterator begin = cend();
+	const_iterator end = cend();
+	
+	if (!begin.seekPrefixed(prefix, end)) return const_range(cend(), cend());
+	
+	return const_range(begin, end);
+}
+
+
+// Returns the first string not less than string (greater than string if strict)
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie_snapshot<charT, reservedChar, binaryKeys>::lowerBound(std::basic_string_view<charT> string, bool strict) const -> const_iterator {
+	const_iterator iterator = cend();
+	
+	iterator.seekLowerBound(string, strict);
+	
+	return iterator;
+}
+
+
+/* concurrent_string_trie */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie<charT, reservedChar, binaryKeys>::concurrent_string_trie() : root_(nullptr), size_(0), epoch_(0), writerMutex_(), retired_() {
+	for (auto& stripe : stripes_) {
+		stripe.readers[0].store(0);
+		stripe.readers[1].store(0);
+	}
+}
+
+// Shares every node with otherTrie
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie<charT, reservedChar, binaryKeys>::concurrent_string_trie(const concurrent_string_trie& otherTrie) : concurrent_string_trie() {
+	std::lock_guard<std::mutex> lock(otherTrie.writerMutex_);
+	
+	const node* root = otherTrie.root_.load();
+	
+	if (root) retain(root);
+	
+	root_.store(root);
+	size_.store(otherTrie.size_.load());
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie<charT, reservedChar, binaryKeys>::~concurrent_string_trie() {
+	for (const auto& retired : retired_) {
+		release(retired.first);
+	}
+	
+	const node* root = root_.load();
+	
+	if (root) release(root);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+concurrent_string_trie<charT, reservedChar, binaryKeys>& concurrent_string_trie<charT, reservedChar, binaryKeys>::operator=(const concurrent_string_trie& otherTrie) {
+	if (this == &otherTrie) return *this;
+	
+	
+	const node* root;
+	size_t size;
+	
+	{
+		std::lock_guard<std::mutex> lock(otherTrie.writerMutex_);
+		
+		root = otherTrie.root_.load();
+		size = otherTrie.size_.load();
+		
+		if (root) retain(root);
+	}
+	
+	
+	std::lock_guard<std::mutex> lock(writerMutex_);
+	
+	publish(root);
+	size_.store(size);
+	
+	return *this;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::read() const -> snapshot {
+	return snapshot(*this);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::clear() {
+	std::lock_guard<std::mutex> lock(writerMutex_);
+	
+	publish(nullptr);
+	size_.store(0);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool concurrent_string_trie<charT, reservedChar, binaryKeys>::empty() const {
+	return size() == 0;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t concurrent_string_trie<charT, reservedChar, binaryKeys>::size() const {
+	return size_.load();
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::insert(std::basic_string_view<charT> string) {
+	validateString(string);
+	
+	
+	std::lock_guard<std::mutex> lock(writerMutex_);
+	
+	const node* root = root_.load();
+	
+	if (!root) {
+		publish(newLeafNode(string));
+		size_++;
+		
+		return;
+	}
+	
+	
+	std::vector<path_entry> path;
+	const node* node = searchPath(string, path);
+	
+	typename std::basic_string<charT>::size_type compareIndex = indexOfFirstDifference(string, *node);
+	
+	if (compareIndex == std::basic_string<charT>::npos) return;  // string already exists
+	
+	
+	const leaf_node* leaf = newLeafNode(string);
+	
+	size_t depth = path.size();
+	const struct node* replacement;
+	
+	if (!node->isLeaf() && compareIndex == static_cast<const inner_node*>(node)->compareIndex) {
+		// String follows the whole path to node, which just needs another child, or a terminal leaf if string ends there
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		if (compareIndex == string.length()) {
+			replacement = copyInnerNode(*inner, terminalIndex, leaf, false, charT());
+		} else {
+			unsigned index;
+			inner->find(string[compareIndex], index);
+			
+			replacement = copyInnerNode(*inner, index, leaf, true, string[compareIndex]);
+		}
+	} else {
+		// A new inner node goes above the topmost node on the path that branches after the first difference
+		while (depth > 0 && path[depth - 1].node->compareIndex > compareIndex) depth--;
+		
+		const struct node* sibling = depth > 0 ? path[depth - 1].node->branch(path[depth - 1].index) : root;
+		const leaf_node& representative = representativeOf(*sibling);
+		
+		retain(sibling);  // now shared by the old and the new version
+		
+		
+		// At most one of the two ends at compareIndex, and becomes the terminal leaf. An existing key can only end
+		// there if sibling is that key's leaf, as every key below an inner node is longer than its compare index.
+		inner_node* inner;
+		
+		if (representative.length == compareIndex) {
+			inner = newInnerNode(1, compareIndex);
+			inner->children()[0] = leaf;
+			inner->characters()[0] = string[compareIndex];
+			inner->hasTerminal = true;
+			inner->representative = &representative;
+		} else if (string.length() == compareIndex) {
+			inner = newInnerNode(1, compareIndex);
+			inner->children()[0] = sibling;
+			inner->characters()[0] = representative.key()[compareIndex];
+			inner->hasTerminal = true;
+			inner->representative = leaf;
+		} else {
+			inner = newInnerNode(2, compareIndex);
+			
+			bool leafFirst = inner_node::less(string[compareIndex], representative.key()[compareIndex]);
+			
+			inner->children()[leafFirst ? 0 : 1] = leaf;
+			inner->characters()[leafFirst ? 0 : 1] = string[compareIndex];
+			inner->children()[leafFirst ? 1 : 0] = sibling;
+			inner->characters()[leafFirst ? 1 : 0] = representative.key()[compareIndex];
+			inner->representative = leaf;
+		}
+		
+		replacement = inner;
+	}
+	
+	publish(copyPath(path, depth, replacement));
+	size_++;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::remove(std::basic_string_view<charT> string) {
+	validateString(string);
+	
+	
+	std::lock_guard<std::mutex> lock(writerMutex_);
+	
+	if (!root_.load()) return;
+	
+	
+	std::vector<path_entry> path;
+	const node* node = searchPath(string, path);
+	
+	if (!node->isLeaf() || indexOfFirstDifference(string, *node) != std::basic_string<charT>::npos) return;
+	
+	
+	const struct node* replacement = nullptr;
+	
+	if (!path.empty()) {
+		const inner_node* parent = path.back().node;
+		unsigned index = path.back().index;
+		
+		if (parent->numBranches() == 2) {
+			// The parent would be left with one branch, which takes its place
+			if (index == terminalIndex) {
+				replacement = parent->children()[0];
+			} else if (parent->hasTerminal) {
+				replacement = parent->terminal();
+			} else {
+				replacement = parent->children()[1 - index];
+			}
+			
+			retain(replacement);
+		} else {
+			replacement = copyInnerNode(*parent, index, nullptr, false, charT());
+		}
+		
+		replacement = copyPath(path, path.size() - 1, replacement);
+	}
+	
+	publish(replacement);
+	size_--;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool concurrent_string_trie<charT, reservedChar, binaryKeys>::contains(std::basic_string_view<charT> string) const {
+	return read().contains(string);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::synchronize() {
+	std::lock_guard<std::mutex> lock(writerMutex_);
+	
+	while (!retired_.empty()) {
+		if (!advanceEpoch()) std::this_thread::yield();
+	}
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+std::pair<unsigned, unsigned> concurrent_string_trie<charT, reservedChar, binaryKeys>::enterReader() const {
+	unsigned stripe = stripeOfThisThread();
+	unsigned parity = epoch_.load() & 1;
+	
+	stripes_[stripe].readers[parity].fetch_add(1);
+	
+	return std::make_pair(stripe, parity);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::exitReader(std::pair<unsigned, unsigned> slot) const {
+	stripes_[slot.first].readers[slot.second].fetch_sub(1, std::memory_order_release);
+}
+
+// Makes root the trie's root, handing over its reference. The old root is released once no reader can be using it.
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::publish(const node* root) {
+	const node* oldRoot = root_.exchange(root);
+	
+	if (oldRoot) retired_.push_back(std::make_pair(oldRoot, epoch_.load()));
+	
+	advanceEpoch();
+}
+
+// Moves to the next epoch if no reader is still counted in the parity that the next epoch will use, then releases the
+// roots replaced at least two epochs ago. A reader that loaded a root before it was replaced incremented one of the two
+// counters before that, and each of the two advances since checked one of them, so it has finished.
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool concurrent_string_trie<charT, reservedChar, binaryKeys>::advanceEpoch() {
+	unsigned epoch = epoch_.load();
+	
+	for (const auto& stripe : stripes_) {
+		if (stripe.readers[(epoch + 1) & 1].load() != 0) return false;
+	}
+	
+	epoch_.store(++epoch);
+	
+	
+	size_t numReleased = 0;
+	
+	while (numReleased < retired_.size() && epoch - retired_[numReleased].second >= 2) {
+		release(retired_[numReleased].first);
+		
+		numReleased++;
+	}
+	
+	retired_.erase(retired_.begin(), retired_.begin() + numReleased);
+	
+	return true;
+}
+
+
+// Walks down towards string, recording each inner node passed and the branch taken, and returns where it stopped
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::searchPath(std::basic_string_view<charT> string, std::vector<path_entry>& path) const -> const node* {
+	const node* node = root_.load();
+	
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		unsigned index = terminalIndex;
+		
+		if (inner->compareIndex == string.length()) {
+			if (!inner->hasTerminal) break;
+		} else if (inner->compareIndex > string.length() || !inner->find(string[inner->compareIndex], index)) {
+			break;
+		}
+		
+		path.push_back(path_entry{inner, index});
+		node = inner->branch(index);
+	}
+	
+	return node;
+}
+
+// Copies the first depth nodes of path, bottom up, with each one's branch along the path replaced by the copy below it
+// and the deepest one's by replacement
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::copyPath(const std::vector<path_entry>& path, size_t depth, const node* replacement) -> const node* {
+	for (size_t i = depth; i > 0; i--) {
+		replacement = copyInnerNode(*path[i - 1].node, path[i - 1].index, replacement, false, charT());
+	}
+	
+	return replacement;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::newLeafNode(std::basic_string_view<charT> string) -> leaf_node* {
+	leaf_node* leaf = new (::operator new(leaf_node::allocationSize(string.length()))) leaf_node(string.length());
+	
+	std::copy(string.begin(), string.end(), leaf->key());
+	
+	return leaf;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::newInnerNode(unsigned numChildren, typename std::basic_string<charT>::size_type compareIndex) -> inner_node* {
+	return new (::operator new(inner_node::allocationSize(numChildren))) inner_node(numChildren, compareIndex);
+}
+
+// Copies otherNode with the child at index replaced by child, child inserted at index if insertChild, or the child at
+// index left out if child is nullptr. For terminalIndex, the terminal leaf is set to child, or left out if child is
+// nullptr. The copy takes a reference to each branch it shares with otherNode.
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::copyInnerNode(const inner_node& otherNode, unsigned index, const node* child, bool insertChild, charT character) -> inner_node* {
+	bool terminal = index == terminalIndex;
+	
+	unsigned numChildren = otherNode.numChildren;
+	
+	if (!terminal) numChildren = numChildren + (insertChild ? 1 : 0) - (child ? 0 : 1);
+	
+	inner_node* copy = newInnerNode(numChildren, otherNode.compareIndex);
+	
+	unsigned j = 0;
+	
+	for (unsigned i = 0; i <= otherNode.numChildren; i++) {
+		if (!terminal && i == index && child) {
+			copy->children()[j] = child;
+			copy->characters()[j] = insertChild ? character : otherNode.characters()[i];
+			j++;
+			
+			if (!insertChild) continue;  // replaced
+		} else if (!terminal && i == index) {
+			continue;  // left out
+		}
+		
+		if (i == otherNode.numChildren) break;
+		
+		
+		copy->children()[j] = otherNode.children()[i];
+		copy->characters()[j] = otherNode.characters()[i];
+		j++;
+		
+		retain(otherNode.children()[i]);
+	}
+	
+	assert(j == numChildren);
+	
+	
+	const node* terminalLeaf = terminal ? child : otherNode.terminal();
+	
+	if (terminalLeaf) {
+		if (!terminal) retain(terminalLeaf);
+		
+		copy->hasTerminal = true;
+		copy->representative = static_cast<const leaf_node*>(terminalLeaf);
+	} else {
+		copy->representative = &representativeOf(*copy->children()[0]);
+	}
+	
+	return copy;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::retain(const node* node) {
+	node->references.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Drops one reference to node, freeing it and releasing its branches if it was the last
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::release(const node* node) {
+	// Avoid recursion as we may have very many levels
+	std::vector<const struct node*> nodes(1, node);
+	
+	while (!nodes.empty()) {
+		const struct node* current = nodes.back();
+		nodes.pop_back();
+		
+		if (current->references.fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+		
+		
+		if (current->isLeaf()) {
+			static_cast<const leaf_node*>(current)->~leaf_node();
+		} else {
+			const inner_node* inner = static_cast<const inner_node*>(current);
+			
+			nodes.insert(nodes.end(), inner->children(), inner->children() + inner->numChildren);
+			
+			if (inner->hasTerminal) nodes.push_back(inner->terminal());
+			
+			inner->~inner_node();
+		}
+		
+		::operator delete(const_cast<struct node*>(current));
+	}
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+const charT* concurrent_string_trie<charT, reservedChar, binaryKeys>::keyOf(const leaf_node& leaf) {
+	return leaf.key();
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::representativeOf(const node& node) -> const leaf_node& {
+	return node.isLeaf() ? static_cast<const leaf_node&>(node) : *static_cast<const inner_node&>(node).representative;
+}
+
+// Returns the child of inner that string continues into (the terminal leaf if string ends at inner's compare index),
+// or nullptr if string ends before inner's compare index or has no child there
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto concurrent_string_trie<charT, reservedChar, binaryKeys>::childTowards(const inner_node& inner, std::basic_string_view<charT> string) -> const node* {
+	if (inner.compareIndex == string.length()) return inner.terminal();
+	if (inner.compareIndex > string.length()) return nullptr;
+	
+	const node* const* child = inner.find(string[inner.compareIndex]);
+	
+	return child ? *child : nullptr;
+}
+
+// Returns npos if string is a leaf's key, and otherwise the index at which string leaves the path to node
+template<typename charT, charT reservedChar, bool binaryKeys>
+typename std::basic_string<charT>::size_type concurrent_string_trie<charT, reservedChar, binaryKeys>::indexOfFirstDifference(std::basic_string_view<charT> string, const node& node) {
+	const leaf_node& leaf = representativeOf(node);
+	
+	typename std::basic_string<charT>::size_type length1 = string.length();
+	typename std::basic_string<charT>::size_type length2 = node.isLeaf() ? leaf.length : static_cast<const inner_node&>(node).compareIndex;
+	
+	typename std::basic_string<charT>::size_type length = std::min(length1, length2);
+	
+	for (typename std::basic_string<charT>::size_type i = 0; i < length; i++) {
+		if (string[i] != leaf.key()[i]) return i;  // if characters do not match, return index
+	}
+	
+	if (node.isLeaf() && length1 == length2) return std::basic_string<charT>::npos;  // all characters matched
+	
+	// Otherwise one of them ends first (for an inner node, string may continue at the node's compare index)
+	return length;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+unsigned concurrent_string_trie<charT, reservedChar, binaryKeys>::stripeOfThisThread() {
+	static std::atomic<unsigned> nextStripe(0);
+	thread_local unsigned stripe = nextStripe++ % numStripes;
+	
+	return stripe;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void concurrent_string_trie<charT, reservedChar, binaryKeys>::validateString(std::basic_string_view<charT> string) {
+	if (binaryKeys) return;  // any string is a valid key
+	
+	if (string.length() == 0) throw std::invalid_argument("String must not be empty.");  // string cannot be empty
+	if (string.find_first_of(reservedChar) != std::basic_string_view<charT>::npos) throw std::invalid_argument("String must not contain specified reserved character.");  // string cannot contain reserved character
+}
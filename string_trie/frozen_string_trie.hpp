@@ -0,0 +1,182 @@
+// string_trie: A C++ Patricia trie implementation for strings.
+// Copyright (C) 2013 Darren Mo
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef _FROZEN_STRING_TRIE_H_
+#define _FROZEN_STRING_TRIE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <iterator>
+
+#include "string_trie.hpp"
+
+
+/* Template declarations */
+
+template<typename charT, charT reservedChar> class frozen_string_trie_const_iterator;
+
+template<typename charT, charT reservedChar>
+bool operator==(const frozen_string_trie_const_iterator<charT, reservedChar>& iterator1, const frozen_string_trie_const_iterator<charT, reservedChar>& iterator2);
+
+template<typename charT, charT reservedChar>
+bool operator!=(const frozen_string_trie_const_iterator<charT, reservedChar>& iterator1, const frozen_string_trie_const_iterator<charT, reservedChar>& iterator2);
+
+
+/* Frozen string trie class */
+
+// An immutable trie kept in one block of bytes with no pointers, so it can be saved to a file and used straight from
+// a read-only memory mapping. Processes that open the same file share its pages.
+template<typename charT, charT reservedChar>
+class frozen_string_trie {
+public:
+	typedef frozen_string_trie_const_iterator<charT, reservedChar> const_iterator;
+	typedef string_trie_reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef string_trie_range<const_iterator> const_range;
+	
+	
+	frozen_string_trie();
+	explicit frozen_string_trie(const string_trie<charT, reservedChar>& trie);
+	frozen_string_trie(frozen_string_trie&& otherTrie);
+	
+	~frozen_string_trie();
+	
+	frozen_string_trie& operator=(frozen_string_trie&& otherTrie);
+	
+	
+	/* The following throw std::runtime_error if the file cannot be read or written, or is not a frozen trie of this
+	   version and type. open() checks every node and key offset, so it reads the whole file once. */
+	
+	static frozen_string_trie open(const std::string& path);  // maps the file read-only
+	void save(const std::string& path) const;
+	
+	
+	const_iterator cbegin() const;
+	const_iterator cend() const;
+	const_reverse_iterator crbegin() const;
+	const_reverse_iterator crend() const;
+	
+	
+	bool empty() const;
+	size_t size() const;
+	
+	size_t memoryUsage() const;  // bytes of the image, which are shared when mapped
+	
+	
+	/* The following throw std::invalid_argument if string contains reservedChar or is empty. */
+	
+	bool contains(std::basic_string_view<charT> string) const;
+	
+	const_iterator predecessor(std::basic_string_view<charT> string) const;
+	const_iterator successor(std::basic_string_view<charT> string) const;
+	
+	const_range prefixedStrings(std::basic_string_view<charT> prefix) const;
+
+private:
+	friend class frozen_string_trie_const_iterator<charT, reservedChar>;
+	
+	
+	struct header;
+	struct node;
+	
+	static const uint32_t version = 2;
+	static const uint32_t leafFlag = 0x80000000;  // set in a child reference that is a leaf's index
+	static const size_t numSections = 5;
+	
+	
+	const unsigned char* image_;
+	size_t imageSize_;
+	
+	std::vector<uint64_t> ownedImage_;  // backs the image of a trie frozen in memory
+	void* mapping_;  // backs the image of an opened file
+	
+	const header* header_;
+	const node* nodes_;
+	const uint32_t* children_;
+	const charT* characters_;
+	const uint64_t* keyOffsets_;  // numKeys + 1 of them; key i ends where key i + 1 starts
+	const charT* keys_;  // every key, in order
+	
+	
+	frozen_string_trie(const frozen_string_trie& otherTrie);
+	
+	frozen_string_trie& operator=(const frozen_string_trie& otherTrie);
+	
+	
+	void attach(const unsigned char* image, size_t imageSize);
+	void detach();
+	
+	void validateImage() const;
+	
+	size_t lowerBound(std::basic_string_view<charT> string, bool strict) const;
+	
+	size_t firstLeafOf(uint32_t reference) const;
+	size_t endLeafOf(uint32_t reference) const;
+	
+	const uint32_t* findChild(const node& node, charT character) const;
+	const uint32_t* nextChild(const node& node, charT character) const;
+	
+	const charT* keyOf(size_t leaf) const;
+	size_t keyLengthOf(size_t leaf) const;
+	
+	static void validateString(std::basic_string_view<charT> string);
+	static size_t layoutOf(const header& imageHeader, size_t sectionOffsets[numSections]);
+	
+	static void swap(frozen_string_trie& trie1, frozen_string_trie& trie2);
+};
+
+
+/* Frozen string trie iterators */
+
+// Leaves are stored in order, so an iterator is just the index of its leaf
+template<typename charT, charT reservedChar>
+class frozen_string_trie_const_iterator {
+	friend class frozen_string_trie<charT, reservedChar>;
+	
+	friend bool operator==<>(const typename frozen_string_trie<charT, reservedChar>::const_iterator& iterator1, const typename frozen_string_trie<charT, reservedChar>::const_iterator& iterator2);
+	
+	friend bool operator!=<>(const typename frozen_string_trie<charT, reservedChar>::const_iterator& iterator1, const typename frozen_string_trie<charT, reservedChar>::const_iterator& iterator2);
+
+public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef std::basic_string<charT> value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef string_trie_key_view<charT> reference;
+	
+	
+	frozen_string_trie_const_iterator();
+	
+	reference operator*() const;
+	frozen_string_trie_const_iterator& operator++();
+	frozen_string_trie_const_iterator operator++(int i);
+	frozen_string_trie_const_iterator& operator--();
+	frozen_string_trie_const_iterator operator--(int i);
+
+private:
+	const frozen_string_trie<charT, reservedChar>* trie_;
+	size_t leaf_;  // size() past the end
+	
+	
+	frozen_string_trie_const_iterator(const frozen_string_trie<charT, reservedChar>& trie, size_t leaf);
+};
+
+
+#include "frozen_string_trie.tpp"
+
+#endif
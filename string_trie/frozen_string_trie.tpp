@@ -0,0 +1,735 @@
+// string_trie: A C++ Patricia trie implementation for strings.
+// Copyright (C) 2013 Darren Mo
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Image layout */
+
+// The image is the header followed by the nodes, the child references, the child characters, the key offsets and the
+// keys, each section starting on an 8-byte boundary. Everything is stored in the byte order of the machine that froze
+// the trie.
+template<typename charT, charT reservedChar>
+struct frozen_string_trie<charT, reservedChar>::header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;  // byteOrderMark as written by the machine that froze the trie
+	uint32_t characterSize;
+	uint32_t reservedCharacter;
+	
+	uint64_t numKeys;
+	uint64_t numNodes;
+	uint64_t numChildren;
+	uint64_t numCharacters;  // in the keys section
+	
+	uint32_t root;  // child reference to the root; unused if there are no keys
+	uint32_t padding;
+};
+
+// An inner node. Its children are numChildren consecutive entries of the child sections, ordered by character, and the
+// leaves below it are the consecutive range [firstLeaf, endLeaf). A key that ends at compareIndex is not a child; it
+// is the node's first leaf, which is how it can be told apart.
+template<typename charT, charT reservedChar>
+struct frozen_string_trie<charT, reservedChar>::node {
+	uint32_t compareIndex;
+	uint32_t firstChild;
+	uint32_t numChildren;
+	uint32_t firstLeaf;
+	uint32_t endLeaf;
+};
+
+namespace frozen_string_trie_format {
+	static const char magic[8] = {'S', 'T', 'R', 'T', 'R', 'I', 'E', '\0'};
+	static const uint32_t byteOrderMark = 0x01020304;
+	
+	inline size_t roundUp(size_t size) {
+		return (size + 7) & ~static_cast<size_t>(7);
+	}
+}
+
+
+/* frozen_string_trie_const_iterator */
+
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar>::frozen_string_trie_const_iterator() : trie_(nullptr), leaf_(0) {
+}
+
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar>::frozen_string_trie_const_iterator(const frozen_string_trie<charT, reservedChar>& trie, size_t leaf) : trie_(&trie), leaf_(leaf) {
+}
+
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie_const_iterator<charT, reservedChar>::operator*() const -> reference {
+	assert(leaf_ < trie_->size());
+	
+	return reference(trie_->keyOf(leaf_), trie_->keyLengthOf(leaf_));
+}
+
+// Like string_trie's iterators, incrementing the past-the-end iterator gives the first string
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar>& frozen_string_trie_const_iterator<charT, reservedChar>::operator++() {
+	leaf_ = leaf_ == trie_->size() ? 0 : leaf_ + 1;
+	
+	return *this;
+}
+
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar> frozen_string_trie_const_iterator<charT, reservedChar>::operator++(int i) {
+	frozen_string_trie_const_iterator tmp = *this;
+	
+	++*this;
+	
+	return tmp;
+}
+
+// Like string_trie's iterators, decrementing the first string gives the past-the-end iterator
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar>& frozen_string_trie_const_iterator<charT, reservedChar>::operator--() {
+	leaf_ = leaf_ == 0 ? trie_->size() : leaf_ - 1;
+	
+	return *this;
+}
+
+template<typename charT, charT reservedChar>
+frozen_string_trie_const_iterator<charT, reservedChar> frozen_string_trie_const_iterator<charT, reservedChar>::operator--(int i) {
+	frozen_string_trie_const_iterator tmp = *this;
+	
+	--*this;
+	
+	return tmp;
+}
+
+
+template<typename charT, charT reservedChar>
+bool operator==(const frozen_string_trie_const_iterator<charT, reservedChar>& iterator1, const frozen_string_trie_const_iterator<charT, reservedChar>& iterator2) {
+	return iterator1.trie_ == iterator2.trie_ && iterator1.leaf_ == iterator2.leaf_;
+}
+
+template<typename charT, charT reservedChar>
+bool operator!=(const frozen_string_trie_const_iterator<charT, reservedChar>& iterator1, const frozen_string_trie_const_iterator<charT, reservedChar>& iterator2) {
+	return !(iterator1 == iterator2);
+}
+
+
+/* frozen_string_trie */
+
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar>::frozen_string_trie() : image_(nullptr), imageSize_(0), ownedImage_(), mapping_(nullptr), header_(nullptr), nodes_(nullptr), children_(nullptr), characters_(nullptr), keyOffsets_(nullptr), keys_(nullptr) {
+}
+
+// Lays out the nodes depth first, so that the leaves come out in order
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar>::frozen_string_trie(const string_trie<charT, reservedChar>& trie) : frozen_string_trie() {
+	typedef typename string_trie<charT, reservedChar>::node trie_node;
+	typedef typename string_trie<charT, reservedChar>::leaf_node trie_leaf_node;
+	typedef typename string_trie<charT, reservedChar>::inner_node trie_inner_node;
+	
+	
+	std::vector<node> nodes;
+	std::vector<uint32_t> children;
+	std::vector<charT> characters;
+	std::vector<uint64_t> keyOffsets;
+	std::vector<charT> keys;
+	
+	uint32_t root = 0;
+	
+	keyOffsets.reserve(trie.size() + 1);
+	
+	
+	// Each pending node remembers the child reference it has to fill in
+	static const size_t rootSlot = static_cast<size_t>(-1);
+	static const size_t terminalSlot = static_cast<size_t>(-2);  // a terminal leaf has no child reference
+	
+	std::vector<std::pair<const trie_node*, size_t>> pending;
+	std::vector<const trie_node*> siblings;
+	
+	if (trie.root_) pending.push_back(std::make_pair(trie.root_, rootSlot));
+	
+	while (!pending.empty()) {
+		const trie_node* current = pending.back().first;
+		size_t slot = pending.back().second;
+		pending.pop_back();
+		
+		uint32_t reference;
+		
+		if (current->isLeaf()) {
+			const trie_leaf_node* leaf = static_cast<const trie_leaf_node*>(current);
+			
+			if (keyOffsets.size() >= leafFlag) throw std::length_error("Trie has too many strings to freeze.");
+			
+			reference = static_cast<uint32_t>(keyOffsets.size()) | leafFlag;
+			
+			const charT* key = trie.keyOf(*leaf);
+			
+			keyOffsets.push_back(keys.size());
+			keys.insert(keys.end(), key, key + leaf->length);
+		} else {
+			const trie_inner_node* inner = static_cast<const trie_inner_node*>(current);
+			
+			if (nodes.size() >= leafFlag || children.size() + inner->numChildren >= leafFlag) throw std::length_error("Trie has too many nodes to freeze.");
+			
+			reference = static_cast<uint32_t>(nodes.size());
+			
+			node frozenNode = {static_cast<uint32_t>(inner->compareIndex), static_cast<uint32_t>(children.size()), inner->numChildren, static_cast<uint32_t>(keyOffsets.size()), 0};
+			nodes.push_back(frozenNode);
+			
+			
+			siblings.clear();
+			
+			inner->forEach([&characters, &siblings](charT character, const trie_node* child) {
+				characters.push_back(character);
+				siblings.push_back(child);
+			});
+			
+			size_t firstChild = children.size();
+			children.resize(firstChild + siblings.size());
+			
+			// Pushed backwards so that the first child comes off the stack first, after the terminal leaf
+			for (size_t i = siblings.size(); i > 0; i--) {
+				pending.push_back(std::make_pair(siblings[i - 1], firstChild + i - 1));
+			}
+			
+			if (inner->hasTerminal) pending.push_back(std::make_pair(inner->terminal(), terminalSlot));
+		}
+		
+		if (slot == rootSlot) {
+			root = reference;
+		} else if (slot != terminalSlot) {
+			children[slot] = reference;
+		}
+	}
+	
+	keyOffsets.push_back(keys.size());
+	
+	
+	// Children come after their parents, so going backwards every last child already knows where its leaves end
+	for (size_t i = nodes.size(); i > 0; i--) {
+		node& current = nodes[i - 1];
+		
+		uint32_t lastChild = children[current.firstChild + current.numChildren - 1];
+		
+		current.endLeaf = (lastChild & leafFlag) ? (lastChild & ~leafFlag) + 1 : nodes[lastChild].endLeaf;
+	}
+	
+	
+	header frozenHeader;
+	std::memset(&frozenHeader, 0, sizeof(frozenHeader));
+	
+	std::memcpy(frozenHeader.magic, frozen_string_trie_format::magic, sizeof(frozenHeader.magic));
+	frozenHeader.version = version;
+	frozenHeader.byteOrder = frozen_string_trie_format::byteOrderMark;
+	frozenHeader.characterSize = sizeof(charT);
+	frozenHeader.reservedCharacter = static_cast<uint32_t>(static_cast<typename std::make_unsigned<charT>::type>(reservedChar));
+	frozenHeader.numKeys = keyOffsets.size() - 1;
+	frozenHeader.numNodes = nodes.size();
+	frozenHeader.numChildren = children.size();
+	frozenHeader.numCharacters = keys.size();
+	frozenHeader.root = root;
+	
+	size_t sectionOffsets[numSections];
+	size_t imageSize = layoutOf(frozenHeader, sectionOffsets);
+	
+	ownedImage_.resize(imageSize / sizeof(uint64_t));
+	
+	unsigned char* image = reinterpret_cast<unsigned char*>(ownedImage_.data());
+	
+	std::memcpy(image, &frozenHeader, sizeof(frozenHeader));
+	
+	auto copySection = [image, &sectionOffsets](size_t section, const void* data, size_t size) {
+		if (size > 0) std::memcpy(image + sectionOffsets[section], data, size);
+	};
+	
+	copySection(0, nodes.data(), nodes.size() * sizeof(node));
+	copySection(1, children.data(), children.size() * sizeof(uint32_t));
+	copySection(2, characters.data(), characters.size() * sizeof(charT));
+	copySection(3, keyOffsets.data(), keyOffsets.size() * sizeof(uint64_t));
+	copySection(4, keys.data(), keys.size() * sizeof(charT));
+	
+	attach(image, imageSize);
+}
+
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar>::frozen_string_trie(frozen_string_trie&& otherTrie) : frozen_string_trie() {
+	swap(*this, otherTrie);
+}
+
+
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar>::~frozen_string_trie() {
+	detach();
+}
+
+
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar>& frozen_string_trie<charT, reservedChar>::operator=(frozen_string_trie&& otherTrie) {
+	swap(*this, otherTrie);
+	
+	return *this;
+}
+
+
+template<typename charT, charT reservedChar>
+frozen_string_trie<charT, reservedChar> frozen_string_trie<charT, reservedChar>::open(const std::string& path) {
+	int file = ::open(path.c_str(), O_RDONLY);
+	
+	if (file < 0) throw std::runtime_error("Cannot open \"" + path + "\".");
+	
+	
+	struct stat status;
+	
+	if (fstat(file, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(header))) {
+		close(file);
+		
+		throw std::runtime_error("\"" + path + "\" is not a frozen string trie.");
+	}
+	
+	size_t size = static_cast<size_t>(status.st_size);
+	
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+	
+	close(file);  // the mapping stays valid
+	
+	if (mapping == MAP_FAILED) throw std::runtime_error("Cannot map \"" + path + "\".");
+	
+	
+	frozen_string_trie trie;
+	
+	trie.mapping_ = mapping;
+	trie.imageSize_ = size;  // so that the mapping is released if attach() throws
+	
+	trie.attach(static_cast<const unsigned char*>(mapping), size);
+	
+	return trie;
+}
+
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::save(const std::string& path) const {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	
+	if (image_) file.write(reinterpret_cast<const char*>(image_), imageSize_);
+	
+	file.close();
+	
+	if (!file) throw std::runtime_error("Cannot write \"" + path + "\".");
+}
+
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::cbegin() const -> const_iterator {
+	return const_iterator(*this, 0);
+}
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::cend() const -> const_iterator {
+	return const_iterator(*this, size());
+}
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::crbegin() const -> const_reverse_iterator {
+	return const_reverse_iterator(--cend());
+}
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::crend() const -> const_reverse_iterator {
+	return const_reverse_iterator(cend());
+}
+
+
+template<typename charT, charT reservedChar>
+bool frozen_string_trie<charT, reservedChar>::empty() const {
+	return size() == 0;
+}
+
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::size() const {
+	return header_ ? static_cast<size_t>(header_->numKeys) : 0;
+}
+
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::memoryUsage() const {
+	return sizeof(*this) + imageSize_;
+}
+
+
+template<typename charT, charT reservedChar>
+bool frozen_string_trie<charT, reservedChar>::contains(std::basic_string_view<charT> string) const {
+	validateString(string);
+	
+	if (empty()) return false;
+	
+	
+	uint32_t reference = header_->root;
+	
+	// A string that ends at or above a node can only be the node's terminal leaf, which is its first
+	while (!(reference & leafFlag) && nodes_[reference].compareIndex < string.length()) {
+		const node& current = nodes_[reference];
+		
+		const uint32_t* child = findChild(current, string[current.compareIndex]);
+		
+		if (!child) return false;
+		
+		reference = *child;
+	}
+	
+	
+	size_t leaf = firstLeafOf(reference);
+	
+	return keyLengthOf(leaf) == string.length() && std::equal(string.begin(), string.end(), keyOf(leaf));
+}
+
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::predecessor(std::basic_string_view<charT> string) const -> const_iterator {
+	validateString(string);
+	
+	
+	size_t leaf = lowerBound(string, false);
+	
+	return leaf == 0 ? cend() : const_iterator(*this, leaf - 1);
+}
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::successor(std::basic_string_view<charT> string) const -> const_iterator {
+	validateString(string);
+	
+	
+	return const_iterator(*this, lowerBound(string, true));
+}
+
+
+template<typename charT, charT reservedChar>
+auto frozen_string_trie<charT, reservedChar>::prefixedStrings(std::basic_string_view<charT> prefix) const -> const_range {
+	validateString(prefix);
+	
+	if (empty()) return const_range(cend(), cend());
+	
+	
+	// Follow the prefix down to the first node whose path covers all of it
+	uint32_t reference = header_->root;
+	
+	while (!(reference & leafFlag)) {
+		const node& current = nodes_[reference];
+		
+		if (current.compareIndex >= prefix.length()) break;
+		
+		const uint32_t* child = findChild(current, prefix[current.compareIndex]);
+		
+		if (!child) return const_range(cend(), cend());
+		
+		reference = *child;
+	}
+	
+	
+	// If found node has the specified prefix
+	size_t leaf = firstLeafOf(reference);
+	
+	if (keyLengthOf(leaf) < prefix.length() || !std::equal(prefix.begin(), prefix.end(), keyOf(leaf))) return const_range(cend(), cend());
+	
+	return const_range(const_iterator(*this, leaf), const_iterator(*this, endLeafOf(reference)));
+}
+
+
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::attach(const unsigned char* image, size_t imageSize) {
+	const header* imageHeader = reinterpret_cast<const header*>(image);
+	
+	if (imageSize < sizeof(header) || std::memcmp(imageHeader->magic, frozen_string_trie_format::magic, sizeof(imageHeader->magic)) != 0) throw std::runtime_error("Not a frozen string trie.");
+	
+	if (imageHeader->version != version) throw std::runtime_error("Unsupported frozen string trie version.");
+	if (imageHeader->byteOrder != frozen_string_trie_format::byteOrderMark) throw std::runtime_error("Frozen string trie has a different byte order.");
+	
+	if (imageHeader->characterSize != sizeof(charT) || imageHeader->reservedCharacter != static_cast<uint32_t>(static_cast<typename std::make_unsigned<charT>::type>(reservedChar))) throw std::runtime_error("Frozen string trie has a different character type.");
+	
+	
+	// Bounding the counts keeps the layout arithmetic from overflowing
+	if (imageHeader->numKeys >= leafFlag || imageHeader->numNodes >= leafFlag || imageHeader->numChildren >= leafFlag || imageHeader->numCharacters > imageSize) throw std::runtime_error("Frozen string trie is corrupt.");
+	
+	size_t sectionOffsets[numSections];
+	
+	if (layoutOf(*imageHeader, sectionOffsets) != imageSize) throw std::runtime_error("Frozen string trie is corrupt.");
+	
+	
+	image_ = image;
+	imageSize_ = imageSize;
+	
+	header_ = imageHeader;
+	nodes_ = reinterpret_cast<const node*>(image + sectionOffsets[0]);
+	children_ = reinterpret_cast<const uint32_t*>(image + sectionOffsets[1]);
+	characters_ = reinterpret_cast<const charT*>(image + sectionOffsets[2]);
+	keyOffsets_ = reinterpret_cast<const uint64_t*>(image + sectionOffsets[3]);
+	keys_ = reinterpret_cast<const charT*>(image + sectionOffsets[4]);
+	
+	
+	validateImage();
+}
+
+// Throws std::runtime_error unless every lookup and iterator stays inside the image and terminates. The image is laid
+// out as the constructor lays it out: children after their parents, and the leaves below each node forming the range
+// that its children's ranges split in order.
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::validateImage() const {
+	uint64_t numKeys = header_->numKeys;
+	uint64_t numNodes = header_->numNodes;
+	
+	auto corrupt = []() {
+		throw std::runtime_error("Frozen string trie is corrupt.");
+	};
+	
+	
+	// Keys are never empty, so their offsets increase
+	if (keyOffsets_[0] != 0 || keyOffsets_[numKeys] != header_->numCharacters) corrupt();
+	
+	for (uint64_t i = 0; i < numKeys; i++) {
+		if (keyOffsets_[i] >= keyOffsets_[i + 1]) corrupt();
+	}
+	
+	
+	if (numKeys == 0) {
+		if (numNodes != 0) corrupt();
+		
+		return;
+	}
+	
+	uint32_t root = header_->root;
+	
+	if ((root & leafFlag) ? numKeys != 1 || root != leafFlag : root >= numNodes || nodes_[root].firstLeaf != 0 || nodes_[root].endLeaf != numKeys) corrupt();
+	
+	
+	for (uint64_t i = 0; i < numNodes; i++) {
+		const node& current = nodes_[i];
+		
+		if (current.numChildren == 0 || static_cast<uint64_t>(current.firstChild) + current.numChildren > header_->numChildren) corrupt();
+		if (current.firstLeaf >= current.endLeaf || current.endLeaf > numKeys) corrupt();
+		
+		// Lookups read the first leaf's key up to compareIndex
+		if (keyLengthOf(current.firstLeaf) < current.compareIndex) corrupt();
+		
+		bool hasTerminal = keyLengthOf(current.firstLeaf) == current.compareIndex;
+		uint64_t nextLeaf = current.firstLeaf + hasTerminal;
+		
+		for (uint32_t j = 0; j < current.numChildren; j++) {
+			uint32_t child = children_[current.firstChild + j];
+			
+			if (j > 0 && !std::char_traits<charT>::lt(characters_[current.firstChild + j - 1], characters_[current.firstChild + j])) corrupt();
+			
+			if (child & leafFlag) {
+				if ((child & ~leafFlag) >= numKeys) corrupt();
+			} else {
+				// Pointing only forwards and deeper rules out cycles
+				if (child <= i || child >= numNodes || nodes_[child].compareIndex <= current.compareIndex) corrupt();
+			}
+			
+			if (firstLeafOf(child) != nextLeaf) corrupt();
+			
+			nextLeaf = endLeafOf(child);
+		}
+		
+		if (nextLeaf != current.endLeaf) corrupt();
+	}
+}
+
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::detach() {
+	if (mapping_) munmap(mapping_, imageSize_);
+	
+	std::vector<uint64_t>().swap(ownedImage_);
+	mapping_ = nullptr;
+	
+	image_ = nullptr;
+	imageSize_ = 0;
+	
+	header_ = nullptr;
+	nodes_ = nullptr;
+	children_ = nullptr;
+	characters_ = nullptr;
+	keyOffsets_ = nullptr;
+	keys_ = nullptr;
+}
+
+
+// Returns the index of the first leaf not less than string (greater than string if strict). Works like
+// string_trie::lowerBound().
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::lowerBound(std::basic_string_view<charT> string, bool strict) const {
+	if (empty()) return 0;
+	
+	
+	size_t length = string.length();
+	
+	uint32_t reference = header_->root;
+	
+	while (!(reference & leafFlag)) {
+		const node& current = nodes_[reference];
+		
+		if (current.compareIndex >= length) break;
+		
+		const uint32_t* child = findChild(current, string[current.compareIndex]);
+		
+		if (!child) break;
+		
+		reference = *child;
+	}
+	
+	
+	size_t leaf = firstLeafOf(reference);
+	const charT* key = keyOf(leaf);
+	
+	size_t keyLength = (reference & leafFlag) ? keyLengthOf(leaf) : nodes_[reference].compareIndex;
+	
+	size_t index = 0;
+	while (index < length && index < keyLength && key[index] == string[index]) index++;
+	
+	// Found the string itself, as a leaf or as the terminal leaf of the node it ends at
+	if (index == length && keyLengthOf(leaf) == length) return strict ? leaf + 1 : leaf;
+	
+	// String follows the whole path to the node but has no child there, so it falls between two of the node's children,
+	// or before all of them if it ends there
+	if (!(reference & leafFlag) && index == keyLength) {
+		if (index == length) return leaf;
+		
+		const uint32_t* next = nextChild(nodes_[reference], string[index]);
+		
+		return next ? firstLeafOf(*next) : endLeafOf(reference);
+	}
+	
+	
+	// Otherwise string leaves the trie at index, in the subtree below the deepest node that branches before index.
+	// Every string in that subtree compares the same way to string: one of them ends at index, or they differ there.
+	uint32_t subtree = header_->root;
+	
+	while (!(subtree & leafFlag) && nodes_[subtree].compareIndex < index) {
+		subtree = *findChild(nodes_[subtree], string[nodes_[subtree].compareIndex]);
+	}
+	
+	bool less = index == length || (index < keyLength && std::char_traits<charT>::lt(string[index], key[index]));
+	
+	return less ? firstLeafOf(subtree) : endLeafOf(subtree);
+}
+
+
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::firstLeafOf(uint32_t reference) const {
+	return (reference & leafFlag) ? reference & ~leafFlag : nodes_[reference].firstLeaf;
+}
+
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::endLeafOf(uint32_t reference) const {
+	return (reference & leafFlag) ? (reference & ~leafFlag) + 1 : nodes_[reference].endLeaf;
+}
+
+
+template<typename charT, charT reservedChar>
+const uint32_t* frozen_string_trie<charT, reservedChar>::findChild(const node& node, charT character) const {
+	const charT* first = characters_ + node.firstChild;
+	const charT* last = first + node.numChildren;
+	
+	const charT* i = std::lower_bound(first, last, character, std::char_traits<charT>::lt);
+	
+	return (i != last && *i == character) ? children_ + (i - characters_) : nullptr;
+}
+
+// The first child whose character is greater than character
+template<typename charT, charT reservedChar>
+const uint32_t* frozen_string_trie<charT, reservedChar>::nextChild(const node& node, charT character) const {
+	const charT* first = characters_ + node.firstChild;
+	const charT* last = first + node.numChildren;
+	
+	const charT* i = std::upper_bound(first, last, character, std::char_traits<charT>::lt);
+	
+	return i != last ? children_ + (i - characters_) : nullptr;
+}
+
+
+template<typename charT, charT reservedChar>
+const charT* frozen_string_trie<charT, reservedChar>::keyOf(size_t leaf) const {
+	return keys_ + keyOffsets_[leaf];
+}
+
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::keyLengthOf(size_t leaf) const {
+	return static_cast<size_t>(keyOffsets_[leaf + 1] - keyOffsets_[leaf]);
+}
+
+
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::validateString(std::basic_string_view<charT> string) {
+	if (string.length() == 0) throw std::invalid_argument("String must not be empty.");  // string cannot be empty
+	if (string.find_first_of(reservedChar) != std::basic_string_view<charT>::npos) throw std::invalid_argument("String must not contain specified reserved character.");  // string cannot contain reserved character
+}
+
+// Fills in where each section starts and returns the size of the whole image
+template<typename charT, charT reservedChar>
+size_t frozen_string_trie<charT, reservedChar>::layoutOf(const header& imageHeader, size_t sectionOffsets[numSections]) {
+	using frozen_string_trie_format::roundUp;
+	
+	size_t sectionSizes[numSections] = {
+		static_cast<size_t>(imageHeader.numNodes) * sizeof(node),
+		static_cast<size_t>(imageHeader.numChildren) * sizeof(uint32_t),
+		static_cast<size_t>(imageHeader.numChildren) * sizeof(charT),
+		static_cast<size_t>(imageHeader.numKeys + 1) * sizeof(uint64_t),
+		static_cast<size_t>(imageHeader.numCharacters) * sizeof(charT)
+	};
+	
+	size_t offset = roundUp(sizeof(header));
+	
+	for (size_t i = 0; i < numSections; i++) {
+		sectionOffsets[i] = offset;
+		offset = roundUp(offset + sectionSizes[i]);
+	}
+	
+	return offset;
+}
+
+
+template<typename charT, charT reservedChar>
+void frozen_string_trie<charT, reservedChar>::swap(frozen_string_trie<charT, reservedChar>& trie1, frozen_string_trie<charT, reservedChar>& trie2) {
+	using std::swap;
+	
+	swap(trie1.image_, trie2.image_);
+	swap(trie1.imageSize_, trie2.imageSize_);
+	
+	swap(trie1.ownedImage_, trie2.ownedImage_);
+	swap(trie1.mapping_, trie2.mapping_);
+	
+	swap(trie1.header_, trie2.header_);
+	swap(trie1.nodes_, trie2.nodes_);
+	swap(trie1.children_, trie2.children_);
+	swap(trie1.characters_, trie2.characters_);
+	swap(trie1.keyOffsets_, trie2.keyOffsets_);
+	swap(trie1.keys_, trie2.keys_);
+}
+
+
+/* string_trie */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+frozen_string_trie<charT, reservedChar> string_trie<charT, reservedChar, binaryKeys>::freeze() const {
+	static_assert(!binaryKeys, "A trie of binary keys cannot be frozen.");
+	
+	return frozen_string_trie<charT, reservedChar>(*this);
+}
@@ -19,90 +19,266 @@
 #define _STRING_TRIE_H_
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <iterator>
+#include <limits>
+#include <utility>
 
 
 /* Template declarations */
 
-template<typename charT, charT reservedChar> class string_trie_const_iterator;
-template<typename charT, charT reservedChar> class string_trie_insert_iterator;
+template<typename charT, charT reservedChar, bool binaryKeys = false> class string_trie;
+template<typename charT, charT reservedChar, bool binaryKeys> class string_trie_const_iterator;
+template<typename trieT, typename charT> class string_trie_path;
+template<typename charT, charT reservedChar, bool binaryKeys> class string_trie_insert_iterator;
+template<typename charT, charT reservedChar> class frozen_string_trie;
+template<typename charT> class string_trie_key_view;
+template<typename iteratorT> class string_trie_range;
+template<typename iteratorT> class string_trie_reverse_iterator;
 
-template<typename charT, charT reservedChar>
-bool operator==(const string_trie_const_iterator<charT, reservedChar>& iterator1, const string_trie_const_iterator<charT, reservedChar>& iterator2);
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator==(const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2);
 
-template<typename charT, charT reservedChar>
-bool operator!=(const string_trie_const_iterator<charT, reservedChar>& iterator1, const string_trie_const_iterator<charT, reservedChar>& iterator2);
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator!=(const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2);
+
+// A trie whose strings may be empty and may contain any character
+template<typename charT> using binary_string_trie = string_trie<charT, charT(0), true>;
+
+
+/* Instrumentation */
+
+// Defining STRING_TRIE_INSTRUMENTATION before including this file makes every trie keep the counters below and adds
+// string_trie::statistics(). Without it the counting compiles away.
+#ifdef STRING_TRIE_INSTRUMENTATION
+
+// Running totals for the calling thread; assign string_trie_counters() to reset them
+struct string_trie_counters {
+	size_t queries;  // strings inserted, removed or looked up, batches included
+	size_t nodesVisited;  // inner nodes descended through by queries and iterators
+	size_t nodeAllocations;
+	size_t nodeDeallocations;
+	size_t systemAllocations;  // slabs and large nodes taken from operator new
+	
+	static string_trie_counters& thisThread() {
+		thread_local string_trie_counters counters = string_trie_counters();
+		
+		return counters;
+	}
+};
+
+// The shape of a trie at one moment
+struct string_trie_statistics {
+	size_t numLeaves;
+	size_t numInnerNodes;
+	size_t numInnerNodesOfKind[6];  // node2, node4, node16, node48, node256, sparse
+	size_t numTerminals;  // leaves of keys that end at an inner node
+	
+	std::vector<size_t> depthHistogram;  // leaves at each depth, the root being at depth 0
+	
+	size_t nodeBytes;  // in use by nodes
+	size_t poolBytes;  // held by the node pool, free blocks included
+	size_t keyBytes;  // held by the key arena, removed keys included
+};
+
+#define STRING_TRIE_COUNT(counter, amount) (string_trie_counters::thisThread().counter += (amount))
+
+#else
+
+#define STRING_TRIE_COUNT(counter, amount) ((void)0)
+
+#endif
 
 
 /* String trie class */
 
-template<typename charT, charT reservedChar>
+// Strings are kept in std::basic_string order. Unless binaryKeys is set, they must not be empty or contain reservedChar.
+template<typename charT, charT reservedChar, bool binaryKeys>
 class string_trie {
 public:
-	typedef string_trie_const_iterator<charT, reservedChar> const_iterator;
-	typedef string_trie_insert_iterator<charT, reservedChar> insert_iterator;
+	typedef string_trie_const_iterator<charT, reservedChar, binaryKeys> const_iterator;
+	typedef string_trie_reverse_iterator<const_iterator> const_reverse_iterator;
+	typedef string_trie_insert_iterator<charT, reservedChar, binaryKeys> insert_iterator;
+	typedef string_trie_range<const_iterator> const_range;
 	
 	
 	string_trie();
 	string_trie(const string_trie& otherTrie);
 	string_trie(string_trie&& otherTrie);
 	
+	// Builds the trie in one pass from strings sorted in std::basic_string order; duplicates are skipped. With more than
+	// one thread, the strings for each first character are built in parallel. Throws std::invalid_argument if the
+	// strings are not sorted, and std::invalid_argument or std::length_error for the same strings insert() rejects. Any
+	// iterator whose values convert to std::basic_string_view<charT> will do.
+	template<typename inputIterator> string_trie(inputIterator first, inputIterator last, unsigned numThreads = 1);
+	
 	~string_trie();
 	
-	string_trie& operator=(string_trie otherTrie);
-	string_trie& operator=(string_trie&& otherTrie);
+	string_trie& operator=(string_trie otherTrie);  // copies or moves, as otherTrie is constructed
 	
 	
+	/* Iterators are invalidated by insert(), remove() and clear(). */
+	
 	const_iterator cbegin() const;
 	const_iterator cend() const;
+	const_reverse_iterator crbegin() const;
+	const_reverse_iterator crend() const;
 	insert_iterator inserter();
 	
 	
+	template<typename inputIterator> void assignSorted(inputIterator first, inputIterator last, unsigned numThreads = 1);
+	
 	void clear();
 	bool empty() const;
 	size_t size() const;
 	
+	size_t memoryUsage() const;  // bytes held by the trie, including its nodes and keys
+	
+	frozen_string_trie<charT, reservedChar> freeze() const;  // include frozen_string_trie.hpp to use; not available with binaryKeys
+	
+	
+	/* The following throw std::invalid_argument if string contains reservedChar or is empty, unless binaryKeys is set.
+	   None of them copy string. */
+	
+	void insert(std::basic_string_view<charT> string);  // also throws std::length_error for strings of 2^32 characters or more, or past 2^32 - 1 strings
+	void remove(std::basic_string_view<charT> string);
+	
+	bool contains(std::basic_string_view<charT> string) const;
 	
-	/* The following throw std::invalid_argument if string contains reservedChar or is empty. */
+	const_iterator predecessor(std::basic_string_view<charT> string) const;
+	const_iterator successor(std::basic_string_view<charT> string) const;
 	
-	void insert(std::basic_string<charT> string);
-	void remove(std::basic_string<charT> string);
+	const_range prefixedStrings(std::basic_string_view<charT> prefix) const;
 	
-	bool contains(std::basic_string<charT> string) const;
 	
-	const_iterator predecessor(std::basic_string<charT> string) const;
-	const_iterator successor(std::basic_string<charT> string) const;
+	/* Every inner node counts the leaves below it, so these walk down the trie instead of iterating. countPrefixed()
+	   and rank() throw std::invalid_argument for the strings insert() rejects. Paging through the strings with a prefix
+	   is select(rank(prefix) + i) for i below countPrefixed(prefix). */
 	
-	std::pair<const_iterator, const_iterator> prefixedStrings(std::basic_string<charT> prefix) const;
+	size_t countPrefixed(std::basic_string_view<charT> prefix) const;  // O(depth)
 	
+	// Both add up the counts of the children on the left of the path. node48 and node256 keep running counts for this,
+	// so they cost O(log fan-out) per level; the other kinds visit their children, at most 16 except in sparse nodes.
+	// rank() also walks down once more first to find where string leaves the trie.
+	size_t rank(std::basic_string_view<charT> string) const;  // number of strings less than string
+	const_iterator select(size_t index) const;  // the string with index strings before it, or cend() if there is none
+	
+	
+	/* Batch lookups walk up to batchWidth strings down the trie together, prefetching each string's next node while
+	   the others are being worked on, so that their cache misses overlap. results must have room for count values.
+	   With more than one thread, batches are split into runs of at least minimumBatchRunLength strings, each on a
+	   thread started for the call; smaller batches run on the calling thread alone. Both throw std::invalid_argument,
+	   before looking anything up, for any string the lookups above reject.
+	   Each successorBatch() result is a whole const_iterator, which keeps its path inline: 440 bytes on 64-bit
+	   platforms, written for every string. containsBatch() writes one bool per string. */
+	
+	void containsBatch(const std::basic_string_view<charT>* strings, size_t count, bool* results, unsigned numThreads = 1) const;
+	void successorBatch(const std::basic_string_view<charT>* strings, size_t count, const_iterator* results, unsigned numThreads = 1) const;
+	
+	
+#ifdef STRING_TRIE_INSTRUMENTATION
+	string_trie_statistics statistics() const;  // visits every node
+#endif
 	
 #ifdef DEBUG
 	void printStructure() const;
 	
 	void verifyStructure() const;
+	
+	// Lowers the length insert() and bulk loading accept, so that tests can reach it with real strings; returns the
+	// previous limit. Applies to every trie of this type.
+	static size_t setMaximumKeyLength(size_t length);
 #endif
 	
 private:
+	friend class string_trie_const_iterator<charT, reservedChar, binaryKeys>;
+	friend class string_trie_path<string_trie, charT>;
+	friend class frozen_string_trie<charT, reservedChar>;
+	
+	
 	struct node;
+	struct leaf_node;
+	struct inner_node;
+	
+	template<unsigned capacity> struct sorted_node;
+	typedef sorted_node<2> node2;
+	typedef sorted_node<4> node4;
+	typedef sorted_node<16> node16;
+	struct node48;
+	struct node256;
+	struct sparse_node;
+	
+	class node_pool;
+	
+	struct build_frame;
+	struct batch_lane;
 	
 	
 	node* root_;
 	
 	size_t size_;
 	
+	node_pool pool_;
+	
+	std::vector<charT> keys_;  // every key, stored back to back
+	size_t deadKeyLength_;  // number of characters in keys_ that belong to removed keys
+	
+	static const size_t leafLengthLimit = std::numeric_limits<unsigned>::max();  // what a leaf can record
+	static const size_t leafCountLimit = std::numeric_limits<unsigned>::max();  // what an inner node can count
+	
+	static const size_t minimumCompactionLength = 4096;
+	
+	static const unsigned batchWidth = 16;
+	// Strings per thread of a parallel batch lookup. Starting and joining a thread took about 12 us, as long as about
+	// 100 containsBatch() lookups in a trie that fits in cache, so a run this long spends under 3% of its time on it.
+	static const size_t minimumBatchRunLength = 4096;
 	
-	node* search(const std::basic_string<charT>& string) const;
-	std::vector<node*> searchPath(const std::basic_string<charT>& string) const;
 	
-	const node* leftmostDescendant(const node& root) const;
-	const node* rightmostDescendant(const node& root) const;
+	
+	node* search(std::basic_string_view<charT> string) const;
+	std::vector<node*> searchPath(std::basic_string_view<charT> string) const;
+	
+	const_iterator lowerBound(std::basic_string_view<charT> string, bool strict) const;
+	
+	template<typename descendFunction, typename finishFunction> void walkBatch(const std::basic_string_view<charT>* strings, size_t count, descendFunction descend, finishFunction finish) const;
+	template<typename function> static void runInParallel(size_t count, unsigned numThreads, function run);
+	
+	node* buildSorted(const size_t* offsets, size_t count, node_pool& pool) const;
+	void buildSortedInParallel(const std::vector<size_t>& offsets, unsigned numThreads);
 	
 	node* siblingOfNewInternalNode(typename std::basic_string<charT>::size_type compareIndex, const std::vector<node*>& nodesInSearchPath, node** parentRef) const;
 	
-	static typename std::basic_string<charT>::size_type indexOfFirstDifference(const std::basic_string<charT>& string1, const std::basic_string<charT>& string2);
+	leaf_node* newLeafNode(std::basic_string_view<charT> string);
+	inner_node* newInnerNode(typename node::node_kind kind, unsigned capacity, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative);
+	static inner_node* newInnerNode(node_pool& pool, typename node::node_kind kind, unsigned capacity, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative);
+	static inner_node* newSizedInnerNode(node_pool& pool, size_t numChildren, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative);
+	node* cloneNode(const node& otherNode, const string_trie& otherTrie);
+	void destroyNode(node* node);
+	
+	void addChild(inner_node* node, inner_node* parent, charT character, struct node* child);
+	inner_node* growNode(inner_node* node);
+	inner_node* shrinkNode(inner_node* node);
+	inner_node* resizeNode(inner_node* node, typename node::node_kind kind, unsigned capacity);
+	void replaceChild(inner_node* parent, node* child);
 	
-	static void normalizeString(std::basic_string<charT>& string);
+	void compactKeys();
+	
+	const charT* keyOf(const leaf_node& leaf) const;
+	static const leaf_node& representativeOf(const node& node);
+	static size_t numLeavesOf(const node& node);
+	static size_t numLeavesBefore(const inner_node& inner, std::basic_string_view<charT> string);
+	static node* childTowards(const inner_node& inner, std::basic_string_view<charT> string);
+	charT characterAt(const node& node, typename std::basic_string<charT>::size_type index) const;
+	std::basic_string<charT> stringOf(const node& node) const;
+	
+	typename std::basic_string<charT>::size_type indexOfFirstDifference(std::basic_string_view<charT> string, const node& node) const;
+	
+	static void validateString(std::basic_string_view<charT> string);
+	static void validateLength(std::basic_string_view<charT> string);
+	static size_t maximumKeyLength();
+	
+	static void prefetch(const void* address);
 	
 	static void swap(string_trie& trie1, string_trie& trie2);
 	
@@ -110,51 +286,220 @@ private:
 #ifdef DEBUG
 	void printNode(const node& node) const;
 	
-	void verifyNode(const node& node, typename std::basic_string<charT>::size_type compareIndex, const std::basic_string<charT>& path) const;
+	void verifyNode(const node& node, typename std::basic_string<charT>::size_type compareIndex, const std::basic_string<charT>& path, size_t& numLeaves, size_t& keyLength) const;
+	void verifyChildren(const inner_node& node, size_t& numLeaves, size_t& keyLength) const;
+	
+	static size_t& debugMaximumKeyLength();
 #endif
 };
 
 
+/* Trie paths */
+
+// The path from the root to one leaf, and the walks that move it. string_trie and concurrent_string_trie have inner
+// nodes with the same interface, so the iterators of both build on this; trieT supplies keyOf(), representativeOf(),
+// childTowards() and indexOfFirstDifference().
+template<typename trieT, typename charT>
+class string_trie_path {
+protected:
+	typedef typename trieT::node node;
+	typedef typename trieT::leaf_node leaf_node;
+	typedef typename trieT::inner_node inner_node;
+	
+	struct path_entry {
+		const inner_node* node;
+		charT character;  // of the child we went down to
+		bool terminal;  // went down to the node's terminal leaf instead
+	};
+	
+	static const size_t inlinePathCapacity = 24;
+	
+	
+	const trieT* trie_;
+	const node* root_;
+	const leaf_node* leaf_;  // nullptr past the end
+	
+	// The first entries live inline so that copying an iterator does not allocate for typical depths
+	path_entry inlinePath_[inlinePathCapacity];
+	std::vector<path_entry> overflowPath_;
+	size_t pathLength_;
+	
+	
+	string_trie_path();
+	string_trie_path(const trieT& trie, const node* root);
+	
+	string_trie_key_view<charT> key() const;
+	
+	void stepForward();
+	void stepBack();
+	
+	path_entry& top();
+	void push(const inner_node* node, charT character, bool terminal = false);
+	void pushToward(const inner_node* node, std::basic_string_view<charT> string);
+	void pop();
+	
+	void descendLeftmost(const node* node);
+	void descendRightmost(const node* node);
+	void skipSubtree();
+	
+	void seekLowerBound(std::basic_string_view<charT> string, bool strict);
+	void finishLowerBound(const node* node, std::basic_string_view<charT> string, bool strict);
+	bool seekPrefixed(std::basic_string_view<charT> prefix, string_trie_path& end);
+};
+
+
 /* String trie iterators */
 
-template<typename charT, charT reservedChar>
-class string_trie_const_iterator : public std::iterator<std::forward_iterator_tag, std::basic_string<charT>> {
-	friend bool operator==<>(const typename string_trie<charT, reservedChar>::const_iterator& iterator1, const typename string_trie<charT, reservedChar>::const_iterator& iterator2);
+// Keeps the path from the root to the current leaf, so stepping in either direction only revisits the nodes it has to.
+template<typename charT, charT reservedChar, bool binaryKeys>
+class string_trie_const_iterator : public string_trie_path<string_trie<charT, reservedChar, binaryKeys>, charT> {
+	friend class string_trie<charT, reservedChar, binaryKeys>;
 	
-	friend bool operator!=<>(const typename string_trie<charT, reservedChar>::const_iterator& iterator1, const typename string_trie<charT, reservedChar>::const_iterator& iterator2);
+	friend bool operator==<>(const typename string_trie<charT, reservedChar, binaryKeys>::const_iterator& iterator1, const typename string_trie<charT, reservedChar, binaryKeys>::const_iterator& iterator2);
+	
+	friend bool operator!=<>(const typename string_trie<charT, reservedChar, binaryKeys>::const_iterator& iterator1, const typename string_trie<charT, reservedChar, binaryKeys>::const_iterator& iterator2);
 	
 public:
+	typedef std::bidirectional_iterator_tag iterator_category;
+	typedef std::basic_string<charT> value_type;
+	typedef std::ptrdiff_t difference_type;
+	typedef void pointer;
+	typedef string_trie_key_view<charT> reference;
+	
+	
 	string_trie_const_iterator();
-	string_trie_const_iterator(const string_trie<charT, reservedChar>& trie);
-	string_trie_const_iterator(const string_trie<charT, reservedChar>& trie, const std::basic_string<charT>& string);
 	
-	std::basic_string<charT> operator*();
+	reference operator*() const;
 	string_trie_const_iterator& operator++();
 	string_trie_const_iterator operator++(int i);
+	string_trie_const_iterator& operator--();
+	string_trie_const_iterator operator--(int i);
 	
 private:
-	const string_trie<charT, reservedChar>* trie_;
-	std::basic_string<charT> string_;
+	explicit string_trie_const_iterator(const string_trie<charT, reservedChar, binaryKeys>& trie);
+};
+
+
+// The key an iterator points at. It converts implicitly to basic_string for code that wants its own copy.
+template<typename charT>
+class string_trie_key_view : public std::basic_string_view<charT> {
+public:
+	using std::basic_string_view<charT>::basic_string_view;
 	
+	operator std::basic_string<charT>() const {
+		return std::basic_string<charT>(this->data(), this->length());
+	}
+};
+
+
+// Steps an iterator backwards. The past-the-end iterator comes both after the last string and before the first, so
+// unlike std::reverse_iterator this can keep the iterator at the string it refers to, instead of one string later,
+// and does not have to copy and decrement the iterator on every dereference.
+template<typename iteratorT>
+class string_trie_reverse_iterator {
+public:
+	typedef typename iteratorT::iterator_category iterator_category;
+	typedef typename iteratorT::value_type value_type;
+	typedef typename iteratorT::difference_type difference_type;
+	typedef typename iteratorT::pointer pointer;
+	typedef typename iteratorT::reference reference;
+	
+	
+	string_trie_reverse_iterator() : current_() {}
+	explicit string_trie_reverse_iterator(const iteratorT& current) : current_(current) {}  // current is the string to start at
+	
+	// Like std::reverse_iterator::base(), the iterator to the string after this one
+	iteratorT base() const {
+		iteratorT next = current_;
+		
+		return ++next;
+	}
+	
+	reference operator*() const {
+		return *current_;
+	}
+	
+	string_trie_reverse_iterator& operator++() {
+		--current_;
+		
+		return *this;
+	}
+	
+	string_trie_reverse_iterator operator++(int i) {
+		string_trie_reverse_iterator tmp = *this;
+		
+		--current_;
+		
+		return tmp;
+	}
+	
+	string_trie_reverse_iterator& operator--() {
+		++current_;
+		
+		return *this;
+	}
+	
+	string_trie_reverse_iterator operator--(int i) {
+		string_trie_reverse_iterator tmp = *this;
+		
+		++current_;
+		
+		return tmp;
+	}
+	
+	bool operator==(const string_trie_reverse_iterator& otherIterator) const {
+		return current_ == otherIterator.current_;
+	}
+	
+	bool operator!=(const string_trie_reverse_iterator& otherIterator) const {
+		return current_ != otherIterator.current_;
+	}
 	
-	bool pastEnd() const;
+private:
+	iteratorT current_;
+};
+
+
+// A pair of iterators that can also be used in a range-based for loop
+template<typename iteratorT>
+class string_trie_range : public std::pair<iteratorT, iteratorT> {
+public:
+	string_trie_range(const iteratorT& first, const iteratorT& second) : std::pair<iteratorT, iteratorT>(first, second) {}
+	
+	iteratorT begin() const {
+		return this->first;
+	}
+	
+	iteratorT end() const {
+		return this->second;
+	}
+	
+	bool empty() const {
+		return this->first == this->second;
+	}
 };
 
 
-template<typename charT, charT reservedChar>
-class string_trie_insert_iterator : public std::iterator<std::output_iterator_tag, void, void, void, void> {
+template<typename charT, charT reservedChar, bool binaryKeys>
+class string_trie_insert_iterator {
 public:
-	string_trie_insert_iterator(string_trie<charT, reservedChar>& trie);
+	typedef std::output_iterator_tag iterator_category;
+	typedef void value_type;
+	typedef void difference_type;
+	typedef void pointer;
+	typedef void reference;
+	
+	
+	string_trie_insert_iterator(string_trie<charT, reservedChar, binaryKeys>& trie);
 	
-	string_trie_insert_iterator& operator=(const std::basic_string<charT>& string);
-	string_trie_insert_iterator& operator=(std::basic_string<charT>&& string);
+	string_trie_insert_iterator& operator=(std::basic_string_view<charT> string);
 	
 	string_trie_insert_iterator& operator*();
 	string_trie_insert_iterator& operator++();
 	string_trie_insert_iterator operator++(int i);
 	
 private:
-	string_trie<charT, reservedChar>* trie_;
+	string_trie<charT, reservedChar, binaryKeys>* trie_;
 };
 
 
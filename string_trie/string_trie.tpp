@@ -15,663 +15,2785 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
-#include <map>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <exception>
+#include <functional>
+#include <new>
 #include <stdexcept>
 #include <stack>
+#include <thread>
 #include <utility>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-/* string_trie_const_iterator */
 
-template<typename charT, charT reservedChar>
-string_trie_const_iterator<charT, reservedChar>::string_trie_const_iterator() : trie_(nullptr), string_() {
-}
+/* string_trie_path */
 
-template<typename charT, charT reservedChar>
-string_trie_const_iterator<charT, reservedChar>::string_trie_const_iterator(const string_trie<charT, reservedChar>& trie) : string_trie_const_iterator(trie, std::basic_string<charT>()) {
+template<typename trieT, typename charT>
+string_trie_path<trieT, charT>::string_trie_path() : trie_(nullptr), root_(nullptr), leaf_(nullptr), inlinePath_(), overflowPath_(), pathLength_(0) {
 }
 
-template<typename charT, charT reservedChar>
-string_trie_const_iterator<charT, reservedChar>::string_trie_const_iterator(const string_trie<charT, reservedChar>& trie, const std::basic_string<charT>& string) : trie_(&trie), string_(string) {
-	typename std::basic_string<charT>::size_type position = string_.rfind(reservedChar);
-	
-	if (position != std::basic_string<charT>::npos) string_.erase(position, 1);
-	
-	assert(string_.rfind(reservedChar) == std::basic_string<charT>::npos);
+template<typename trieT, typename charT>
+string_trie_path<trieT, charT>::string_trie_path(const trieT& trie, const node* root) : trie_(&trie), root_(root), leaf_(nullptr), inlinePath_(), overflowPath_(), pathLength_(0) {
 }
 
 
-template<typename charT, charT reservedChar>
-std::basic_string<charT> string_trie_const_iterator<charT, reservedChar>::operator*() {
-	return string_;
+template<typename trieT, typename charT>
+string_trie_key_view<charT> string_trie_path<trieT, charT>::key() const {
+	assert(leaf_);
+	
+	return string_trie_key_view<charT>(trie_->keyOf(*leaf_), leaf_->length);
 }
 
-template<typename charT, charT reservedChar>
-string_trie_const_iterator<charT, reservedChar>& string_trie_const_iterator<charT, reservedChar>::operator++() {
-	if (trie_ && !pastEnd()) *this = trie_->successor(string_);
-	
-	return *this;
+
+// Moves to the next string. Stepping forward from the past-the-end iterator gives the first string, which lets
+// reverse iterators start at the last string.
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::stepForward() {
+	if (leaf_) skipSubtree();
+	else if (root_) descendLeftmost(root_);
 }
 
-template<typename charT, charT reservedChar>
-string_trie_const_iterator<charT, reservedChar> string_trie_const_iterator<charT, reservedChar>::operator++(int i) {
-	string_trie_const_iterator tmp = *this;
+// Moves to the previous string. Stepping back from the past-the-end iterator gives the last string; stepping back from
+// the first string gives the past-the-end iterator.
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::stepBack() {
+	if (!leaf_) {
+		if (root_) descendRightmost(root_);
+		
+		return;
+	}
 	
-	if (trie_ && !pastEnd()) *this = trie_->successor(string_);
+	while (pathLength_ > 0) {
+		path_entry& entry = top();
+		
+		if (!entry.terminal) {
+			const node* sibling = entry.node->previousChild(entry.character);
+			
+			if (sibling) {
+				descendRightmost(sibling);
+				
+				return;
+			}
+			
+			// The terminal leaf comes before every child
+			if (entry.node->hasTerminal) {
+				entry.terminal = true;
+				leaf_ = entry.node->representative;
+				
+				return;
+			}
+		}
+		
+		pop();
+	}
 	
-	return tmp;
-}
-
-
-template<typename charT, charT reservedChar>
-bool string_trie_const_iterator<charT, reservedChar>::pastEnd() const {
-	return string_.length() == 0;
+	leaf_ = nullptr;
 }
 
 
-template<typename charT, charT reservedChar>
-bool operator==(const string_trie_const_iterator<charT, reservedChar>& iterator1, const string_trie_const_iterator<charT, reservedChar>& iterator2) {
-	return iterator1.trie_ == iterator2.trie_ && iterator1.string_ == iterator2.string_;
+template<typename trieT, typename charT>
+auto string_trie_path<trieT, charT>::top() -> path_entry& {
+	assert(pathLength_ > 0);
+	
+	return pathLength_ > inlinePathCapacity ? overflowPath_.back() : inlinePath_[pathLength_ - 1];
 }
 
-template<typename charT, charT reservedChar>
-bool operator!=(const string_trie_const_iterator<charT, reservedChar>& iterator1, const string_trie_const_iterator<charT, reservedChar>& iterator2) {
-	return !(iterator1 == iterator2);
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::push(const inner_node* node, charT character, bool terminal) {
+	path_entry entry = {node, character, terminal};
+	
+	if (pathLength_ < inlinePathCapacity) {
+		inlinePath_[pathLength_] = entry;
+	} else {
+		overflowPath_.push_back(entry);
+	}
+	
+	pathLength_++;
 }
 
-
-/* string_trie_insert_iterator */
-
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar>::string_trie_insert_iterator(string_trie<charT, reservedChar>& trie) : trie_(&trie) {
+// Pushes the branch of node that string goes down
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::pushToward(const inner_node* node, std::basic_string_view<charT> string) {
+	if (node->compareIndex < string.length()) {
+		push(node, string[node->compareIndex]);
+	} else {
+		push(node, charT(), true);
+	}
 }
 
-
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar>& string_trie_insert_iterator<charT, reservedChar>::operator=(const std::basic_string<charT>& string) {
-	trie_->insert(string);
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::pop() {
+	assert(pathLength_ > 0);
 	
-	return *this;
-}
-
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar>& string_trie_insert_iterator<charT, reservedChar>::operator=(std::basic_string<charT>&& string) {
-	trie_->insert(string);
+	if (pathLength_ > inlinePathCapacity) overflowPath_.pop_back();
 	
-	return *this;
+	pathLength_--;
 }
 
 
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar>& string_trie_insert_iterator<charT, reservedChar>::operator*() {
-	return *this;
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::descendLeftmost(const node* node) {
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		STRING_TRIE_COUNT(nodesVisited, 1);
+		
+		if (inner->hasTerminal) {
+			node = inner->terminal();
+			
+			push(inner, charT(), true);
+		} else {
+			charT character = charT();
+			node = inner->firstChild(character);
+			
+			push(inner, character);
+		}
+	}
+	
+	leaf_ = static_cast<const leaf_node*>(node);
 }
 
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar>& string_trie_insert_iterator<charT, reservedChar>::operator++() {
-	return *this;
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::descendRightmost(const node* node) {
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		STRING_TRIE_COUNT(nodesVisited, 1);
+		
+		charT character = charT();
+		node = inner->lastChild(character);
+		
+		push(inner, character);
+	}
+	
+	leaf_ = static_cast<const leaf_node*>(node);
 }
 
-template<typename charT, charT reservedChar>
-string_trie_insert_iterator<charT, reservedChar> string_trie_insert_iterator<charT, reservedChar>::operator++(int i) {
-	return *this;
+// Moves to the first string after the subtree that the path currently leads to
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::skipSubtree() {
+	while (pathLength_ > 0) {
+		path_entry& entry = top();
+		
+		const node* sibling = entry.terminal ? entry.node->firstChild(entry.character) : entry.node->nextChild(entry.character);
+		
+		if (sibling) {
+			entry.terminal = false;
+			
+			descendLeftmost(sibling);
+			
+			return;
+		}
+		
+		pop();
+	}
+	
+	leaf_ = nullptr;
 }
 
 
-/* string_trie */
-
-template<typename charT, charT reservedChar>
-struct string_trie<charT, reservedChar>::node {
-	typedef std::map<charT, node*> child_map;
-	
+// Moves the empty path to the first string not less than string (greater than string if strict)
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::seekLowerBound(std::basic_string_view<charT> string, bool strict) {
+	if (!root_) return;
 	
-	string_trie* trie_;
 	
-	std::basic_string<charT> string;
-	
-	bool isLeaf;
-	typename std::basic_string<charT>::size_type compareIndex;
-	child_map children;
+	const node* current = root_;
 	
+	while (!current->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(current);
+		const node* child = trieT::childTowards(*inner, string);
+		
+		if (!child) break;
+		
+		pushToward(inner, string);
+		current = child;
+	}
 	
-	// Internal node constructor
-	node(typename std::basic_string<charT>::size_type compareIndex, const std::basic_string<charT>& path) : trie_(nullptr), string(path), isLeaf(false), compareIndex(compareIndex), children() {}
+	finishLowerBound(current, string, strict);
+}
+
+// Moves to the lower bound of string from a path that leads to current, where string leaves the trie
+template<typename trieT, typename charT>
+void string_trie_path<trieT, charT>::finishLowerBound(const node* current, std::basic_string_view<charT> string, bool strict) {
+	typename std::basic_string<charT>::size_type index = trie_->indexOfFirstDifference(string, *current);
 	
-	// Leaf node constructor
-	node(string_trie& trie, const std::basic_string<charT>& string) : trie_(&trie), string(string), isLeaf(true), compareIndex(0), children() {
-		trie_->size_++;
+	// Found the string itself
+	if (index == std::basic_string<charT>::npos) {
+		leaf_ = static_cast<const leaf_node*>(current);
+		
+		if (strict) skipSubtree();
+		
+		return;
 	}
 	
-	~node() {
-		if (isLeaf) {
-			assert(trie_);
+	// String follows the whole path to current but has no child there, so it falls between two of its children, or
+	// before all of them if it ends there
+	if (!current->isLeaf() && index == static_cast<const inner_node*>(current)->compareIndex) {
+		const inner_node* inner = static_cast<const inner_node*>(current);
+		
+		if (index == string.length()) {
+			descendLeftmost(inner);
 			
-			trie_->size_--;
+			return;
 		}
+		
+		charT character = string[index];
+		const node* sibling = inner->nextChild(character);
+		
+		if (sibling) {
+			push(inner, character);
+			descendLeftmost(sibling);
+		} else {
+			skipSubtree();
+		}
+		
+		return;
 	}
 	
-private:
-	node(const node& otherNode);
-	node(node&& otherNode);
 	
-	node& operator=(node otherNode);
-};
-
-
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>::string_trie() : root_(nullptr), size_(0) {
+	// Otherwise string leaves the trie at index, in the subtree of the deepest ancestor that branches before index.
+	// Every string in that subtree compares the same way to string: one of them ends at index, or they differ there.
+	const leaf_node& representative = trieT::representativeOf(*current);
+	
+	bool less = index == string.length() || (index < representative.length && inner_node::less(string[index], trie_->keyOf(representative)[index]));
+	
+	while (pathLength_ > 0 && top().node->compareIndex > index) pop();
+	
+	assert(pathLength_ == 0 || !top().terminal);
+	
+	const node* subtree = pathLength_ > 0 ? *top().node->find(top().character) : root_;
+	
+	if (less) {
+		descendLeftmost(subtree);
+	} else {
+		skipSubtree();
+	}
 }
 
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>::string_trie(const string_trie& otherTrie) : string_trie() {
-	// Avoid recursion as we may have very many levels
-	std::stack<node*> nodes;
+// Moves the empty path to the first string with prefix, and end to the first string after them. Returns false if
+// there are none, leaving both undefined.
+template<typename trieT, typename charT>
+bool string_trie_path<trieT, charT>::seekPrefixed(std::basic_string_view<charT> prefix, string_trie_path& end) {
+	if (!root_) return false;
 	
-	node* otherRoot = otherTrie.root_;
 	
-	if (otherRoot) {
-		if (otherRoot->isLeaf) {
-			root_ = new node(*this, otherRoot->string);
-		} else {
-			root_ = new node(otherRoot->compareIndex, otherRoot->string);
-			root_->children = otherRoot->children;
-			
-			nodes.push(root_);
-		}
-	}
+	// Follow the prefix down to the first node whose path covers all of it
+	const node* current = root_;
 	
-	while (!nodes.empty()) {
-		node* node = nodes.top();
-		nodes.pop();
+	while (!current->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(current);
 		
-		for (auto& element : node->children) {
-			struct node* otherNode = element.second;
-			
-			struct node* copy;
-			
-			if (otherNode->isLeaf) {
-				copy = new struct node(*this, otherNode->string);
-			} else {
-				copy = new struct node(otherNode->compareIndex, otherNode->string);
-				copy->children = otherNode->children;
-				
-				nodes.push(copy);
-			}
-			
-			element.second = copy;
-		}
+		if (inner->compareIndex >= prefix.length()) break;
+		
+		STRING_TRIE_COUNT(nodesVisited, 1);
+		
+		const node* const* child = inner->find(prefix[inner->compareIndex]);
+		
+		if (!child) return false;
+		
+		push(inner, prefix[inner->compareIndex]);
+		current = *child;
 	}
+	
+	
+	// If found node has the specified prefix
+	const leaf_node& representative = trieT::representativeOf(*current);
+	
+	if (representative.length < prefix.length() || !std::equal(prefix.begin(), prefix.end(), trie_->keyOf(representative))) return false;
+	
+	
+	end = *this;
+	end.skipSubtree();
+	
+	descendLeftmost(current);
+	
+	return true;
 }
 
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>::string_trie(string_trie&& otherTrie) : string_trie() {
-	swap(*this, otherTrie);
-}
 
+/* string_trie_const_iterator */
 
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>::~string_trie() {
-	clear();
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys>::string_trie_const_iterator() {
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys>::string_trie_const_iterator(const string_trie<charT, reservedChar, binaryKeys>& trie) : string_trie_path<string_trie<charT, reservedChar, binaryKeys>, charT>(trie, trie.root_) {
 }
 
 
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>& string_trie<charT, reservedChar>::operator=(string_trie otherTrie) {
-	swap(*this, otherTrie);
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator*() const -> reference {
+	return this->key();
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys>& string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator++() {
+	this->stepForward();
 	
 	return *this;
 }
 
-template<typename charT, charT reservedChar>
-string_trie<charT, reservedChar>& string_trie<charT, reservedChar>::operator=(string_trie&& otherTrie) {
-	swap(*this, otherTrie);
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys> string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator++(int i) {
+	string_trie_const_iterator tmp = *this;
+	
+	++*this;
+	
+	return tmp;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys>& string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator--() {
+	this->stepBack();
 	
 	return *this;
 }
 
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_const_iterator<charT, reservedChar, binaryKeys> string_trie_const_iterator<charT, reservedChar, binaryKeys>::operator--(int i) {
+	string_trie_const_iterator tmp = *this;
+	
+	--*this;
+	
+	return tmp;
+}
+
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::cbegin() const -> const_iterator {
-	if (root_) {
-		const node* node = leftmostDescendant(*root_);
-		
-		// Remove last character (reserved character)
-		auto string = node->string.substr(0, node->string.length() - 1);
-		
-		return const_iterator(*this, string);
-	} else {
-		return cend();
-	}
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator==(const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2) {
+	return iterator1.trie_ == iterator2.trie_ && iterator1.leaf_ == iterator2.leaf_;
 }
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::cend() const -> const_iterator {
-	return const_iterator(*this);
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool operator!=(const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator1, const string_trie_const_iterator<charT, reservedChar, binaryKeys>& iterator2) {
+	return !(iterator1 == iterator2);
 }
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::inserter() -> insert_iterator {
-	return insert_iterator(*this);
+
+/* string_trie_insert_iterator */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_insert_iterator<charT, reservedChar, binaryKeys>::string_trie_insert_iterator(string_trie<charT, reservedChar, binaryKeys>& trie) : trie_(&trie) {
 }
 
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::clear() {
-	// Avoid recursion as we may have very many levels
-	std::stack<node*> nodes;
-	
-	if (root_) nodes.push(root_);
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_insert_iterator<charT, reservedChar, binaryKeys>& string_trie_insert_iterator<charT, reservedChar, binaryKeys>::operator=(std::basic_string_view<charT> string) {
+	trie_->insert(string);
 	
-	while (!nodes.empty()) {
-		node* node = nodes.top();
-		nodes.pop();
-		
-		if (!node->isLeaf) {
-			for (const auto& element : node->children) {
-				nodes.push(element.second);
-			}
-		}
-		
-		delete node;
-	}
+	return *this;
 }
 
-template<typename charT, charT reservedChar>
-bool string_trie<charT, reservedChar>::empty() const {
-	return size_ == 0;
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_insert_iterator<charT, reservedChar, binaryKeys>& string_trie_insert_iterator<charT, reservedChar, binaryKeys>::operator*() {
+	return *this;
 }
 
-template<typename charT, charT reservedChar>
-size_t string_trie<charT, reservedChar>::size() const {
-	return size_;
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_insert_iterator<charT, reservedChar, binaryKeys>& string_trie_insert_iterator<charT, reservedChar, binaryKeys>::operator++() {
+	return *this;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_insert_iterator<charT, reservedChar, binaryKeys> string_trie_insert_iterator<charT, reservedChar, binaryKeys>::operator++(int i) {
+	return *this;
 }
 
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::insert(std::basic_string<charT> string) {
-	normalizeString(string);
+/* string_trie nodes */
+
+// Inner nodes come in several kinds, chosen by fan-out. Small fan-outs keep sorted key arrays (node2, node4, node16). Past
+// that, byte-sized characters move to an index table (node48) and then a direct table (node256), while wider
+// characters move to a sorted array that doubles as it fills (sparse_node). Every kind visits its children in
+// character order.
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::node {
+	enum node_kind : unsigned char {
+		leafKind,
+		node2Kind,
+		node4Kind,
+		node16Kind,
+		node48Kind,
+		node256Kind,
+		sparseKind
+	};
 	
 	
-	std::vector<node*> nodes = searchPath(string);
+	node_kind kind;
 	
-	if (!nodes.empty()) {  // if node found
-		node* node = nodes.back();
-		
-		typename std::basic_string<charT>::size_type compareIndex = indexOfFirstDifference(string, node->string);
-		
-		// If internal node key matched up with string, then we should compare the last index
-		if (compareIndex == std::basic_string<charT>::npos && !node->isLeaf) compareIndex = string.length() - 1;
-		
-		if (compareIndex != std::basic_string<charT>::npos) {  // if the strings are not the same
-			if (!node->isLeaf && compareIndex == node->string.size() - 1) {  // if node is where we should insert new leaf
-				const charT& character = string[compareIndex];
-				
-				node->children[character] = new struct node(*this, string);
-			} else {  // else, create new internal node and insert it at appropriate position along path
-				struct node* parentOfInternal;
-				struct node* siblingOfInternal = siblingOfNewInternalNode(compareIndex, nodes, &parentOfInternal);
-				
-				std::basic_string<charT> path = string.substr(0, compareIndex).append(1, reservedChar);
-				struct node* internal = new struct node(compareIndex, path);
-				
-				// Set existing node as child of new internal node
-				const charT& existingNodeCharacter = siblingOfInternal->string[compareIndex];
-				internal->children[existingNodeCharacter] = siblingOfInternal;
-				
-				// Set new leaf node as child of new internal node
-				const charT& newNodeCharacter = string[compareIndex];
-				internal->children[newNodeCharacter] = new struct node(*this, string);
-				
-				// Set original parent of existing node as parent of internal node
-				if (parentOfInternal) {
-					const charT& character = siblingOfInternal->string[parentOfInternal->compareIndex];
-					
-					parentOfInternal->children[character] = internal;
-				} else {
-					root_ = internal;
-				}
-			}
-		}
-	} else {
-		root_ = new struct node(*this, string);
+	
+	bool isLeaf() const {
+		return kind == leafKind;
 	}
-}
+	
+	size_t allocationSize() const;
+	
+protected:
+	explicit node(node_kind kind) : kind(kind) {}
+	
+private:
+	node(const node& otherNode);
+	node(node&& otherNode);
+	
+	node& operator=(node otherNode);
+};
+
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::remove(std::basic_string<charT> string) {
-	normalizeString(string);
+// The key itself lives in the trie's key arena
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::leaf_node : node {
+	unsigned length;
+	size_t offset;
 	
 	
-	std::vector<node*> nodes = searchPath(string);
+	leaf_node(size_t offset, unsigned length) : node(node::leafKind), length(length), offset(offset) {}
+};
+
+
+// The path leading to an inner node is the first compareIndex characters of any leaf below it, so each inner node
+// keeps one such leaf as its representative instead of a copy of the path. A key that ends exactly at compareIndex
+// has no character to be a child under; it is the node's terminal leaf instead, and doubles as the representative.
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::inner_node : node {
+	// Key lengths and the number of strings both fit in an unsigned, which keeps this header at 24 bytes
+	bool hasTerminal;
+	unsigned numChildren;  // not counting the terminal leaf
+	unsigned compareIndex;
+	unsigned numLeaves;  // below the node, the terminal leaf included
+	const leaf_node* representative;
 	
-	node* node = nullptr;
-	struct node* parent = nullptr;
-	struct node* parentOfParent = nullptr;
 	
-	if (!nodes.empty()) {
-		node = nodes.back();
-		nodes.pop_back();
+	inner_node(typename node::node_kind kind, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) : node(kind), hasTerminal(false), numChildren(0), compareIndex(static_cast<unsigned>(compareIndex)), numLeaves(0), representative(representative) {}
+	
+	
+	// The terminal leaf sorts before every child
+	node* terminal() const {
+		return hasTerminal ? const_cast<leaf_node*>(representative) : nullptr;
 	}
 	
-	if (!nodes.empty()) {
-		parent = nodes.back();
-		nodes.pop_back();
+	void setTerminal(const leaf_node* leaf) {
+		hasTerminal = true;
+		representative = leaf;
 	}
 	
-	if (!nodes.empty()) {
-		parentOfParent = nodes.back();
-		nodes.pop_back();
+	unsigned numBranches() const {
+		return numChildren + hasTerminal;
 	}
 	
+	node* firstBranch() const {
+		return hasTerminal ? terminal() : first();
+	}
 	
-	if (node && node->isLeaf && node->string == string) {  // if we found a matching leaf node
-		if (parent) {
-			// Remove reference to removed node from parent
-			const charT& character = node->string[parent->compareIndex];
-			
-			parent->children.erase(character);
-			
-			
-			assert(parent->children.size() > 0);
-			
-			if (parent->children.size() == 1) {  // if parent only has one child remaining, then delete parent
-				struct node* onlyChild = parent->children.begin()->second;
-				
-				if (parentOfParent) {  // if parent has a parent, remove the reference to the parent
-					const charT& character = parent->string[parentOfParent->compareIndex];
-					
-					parentOfParent->children[character] = onlyChild;
-					
-					assert(parentOfParent->children.size() >= 2);
-				} else {
-					root_ = onlyChild;
-				}
-				
-				
-				delete parent;
-			}
-		} else {
-			root_ = nullptr;
+	
+	// Returns the slot holding the child for character, or nullptr if there is none
+	node** find(charT character);
+	node* const* find(charT character) const {
+		return const_cast<inner_node*>(this)->find(character);
+	}
+	
+	// Each of these also sets character to the returned child's character
+	node* firstChild(charT& character) const;
+	node* lastChild(charT& character) const;
+	node* nextChild(charT& character) const;  // first child whose character is greater than character
+	node* previousChild(charT& character) const;  // last child whose character is less than character
+	
+	node* first() const {
+		charT character;
+		
+		return firstChild(character);
+	}
+	
+	node* last() const {
+		charT character;
+		
+		return lastChild(character);
+	}
+	
+	node* next(charT character) const {
+		return nextChild(character);
+	}
+	
+	node* previous(charT character) const {
+		return previousChild(character);
+	}
+	
+	bool full() const;
+	bool underfull() const;
+	
+	void insert(charT character, node* child);
+	void erase(charT character);
+	
+	// For rank and select: the leaves below the children whose character is less than character, and the child that
+	// holds leaf number index of the children's leaves (reducing index by the leaves of the children before it, and
+	// setting character to the child's character)
+	size_t numLeavesBefore(charT character) const;
+	node* childHolding(size_t& index, charT& character) const;
+	
+	// Counts a leaf added below or removed from below the child for character, for the kinds that keep leaf counts
+	void leafAdded(charT character);
+	void leafRemoved(charT character);
+	
+	// Calls f(character, child) for every child in character order; f may reassign child
+	template<typename function> void forEach(function f);
+	template<typename function> void forEach(function f) const {
+		const_cast<inner_node*>(this)->forEach(f);
+	}
+	
+	
+	// Children are ordered like the characters of std::basic_string
+	static bool less(charT character1, charT character2) {
+		return std::char_traits<charT>::lt(character1, character2);
+	}
+	
+	// Table positions for node48/node256, ordered the same way as the characters
+	static unsigned slotOf(charT character) {
+		return static_cast<unsigned char>(character) ^ signBit();
+	}
+	
+	static charT characterOf(unsigned slot) {
+		return static_cast<charT>(slot ^ signBit());
+	}
+	
+	static unsigned signBit() {
+		return less(static_cast<charT>(0x80), static_cast<charT>(0x7F)) ? 0x80 : 0;
+	}
+	
+	
+	// The leaves below the children of a node48 or node256, by groups of four table slots, as a Fenwick tree: entry i
+	// holds the groups in (i - lowest bit of i, i], one-based. Updating a group and adding up the groups before one
+	// both touch at most seven entries.
+	struct leaf_counts {
+		unsigned counts[64];
+		
+		
+		void add(unsigned slot, unsigned count) {
+			for (unsigned i = slot / 4 + 1; i <= 64; i += i & -i) {
+				counts[i - 1] += count;
+			}
+		}
+		
+		void subtract(unsigned slot, unsigned count) {
+			for (unsigned i = slot / 4 + 1; i <= 64; i += i & -i) {
+				counts[i - 1] -= count;
+			}
+		}
+		
+		// Leaves below the groups before slot's group
+		size_t before(unsigned slot) const {
+			size_t sum = 0;
+			
+			for (unsigned i = slot / 4; i > 0; i -= i & -i) {
+				sum += counts[i - 1];
+			}
+			
+			return sum;
+		}
+		
+		// Returns the first slot of the group that holds leaf number index, which is reduced by the leaves below the
+		// groups before it
+		unsigned find(size_t& index) const {
+			unsigned group = 0;
+			
+			for (unsigned step = 32; step > 0; step /= 2) {
+				if (counts[group + step - 1] <= index) {
+					index -= counts[group + step - 1];
+					group += step;
+				}
+			}
+			
+			return group * 4;
+		}
+	};
+	
+	
+	// Helpers for the kinds that keep sorted key arrays
+	static unsigned lowerBound(const charT* keys, unsigned count, charT character) {
+		if (count > 16) return static_cast<unsigned>(std::lower_bound(keys, keys + count, character, less) - keys);
+		
+		unsigned i = 0;
+		while (i < count && less(keys[i], character)) i++;
+		
+		return i;
+	}
+	
+	static node* nextChild(const charT* keys, node* const* children, unsigned count, charT& character) {
+		unsigned i = lowerBound(keys, count, character);
+		if (i < count && keys[i] == character) i++;
+		
+		if (i == count) return nullptr;
+		
+		character = keys[i];
+		
+		return children[i];
+	}
+	
+	static node* previousChild(const charT* keys, node* const* children, unsigned count, charT& character) {
+		unsigned i = lowerBound(keys, count, character);
+		
+		if (i == 0) return nullptr;
+		
+		character = keys[i - 1];
+		
+		return children[i - 1];
+	}
+	
+	static void insert(charT* keys, node** children, unsigned count, charT character, node* child) {
+		unsigned i = lowerBound(keys, count, character);
+		
+		assert(i == count || keys[i] != character);
+		
+		std::copy_backward(keys + i, keys + count, keys + count + 1);
+		std::copy_backward(children + i, children + count, children + count + 1);
+		
+		keys[i] = character;
+		children[i] = child;
+	}
+	
+	static void erase(charT* keys, node** children, unsigned count, unsigned index) {
+		std::copy(keys + index + 1, keys + count, keys + index);
+		std::copy(children + index + 1, children + count, children + index);
+	}
+};
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<unsigned capacity>
+struct string_trie<charT, reservedChar, binaryKeys>::sorted_node : inner_node {
+	charT keys[capacity];
+	node* children[capacity];
+	
+	
+	sorted_node(typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) : inner_node(capacity == 2 ? node::node2Kind : capacity == 4 ? node::node4Kind : node::node16Kind, compareIndex, representative), keys(), children() {}
+	
+	
+	node** find(charT character) {
+		int index = indexOf(character);
+		
+		return index >= 0 ? &children[index] : nullptr;
+	}
+	
+	node* firstChild(charT& character) const {
+		character = keys[0];
+		
+		return children[0];
+	}
+	
+	node* lastChild(charT& character) const {
+		character = keys[this->numChildren - 1];
+		
+		return children[this->numChildren - 1];
+	}
+	
+	node* nextChild(charT& character) const {
+		return inner_node::nextChild(keys, children, this->numChildren, character);
+	}
+	
+	node* previousChild(charT& character) const {
+		return inner_node::previousChild(keys, children, this->numChildren, character);
+	}
+	
+	bool full() const {
+		return this->numChildren == capacity;
+	}
+	
+	void insert(charT character, node* child) {
+		assert(!full());
+		
+		inner_node::insert(keys, children, this->numChildren++, character, child);
+	}
+	
+	void erase(charT character) {
+		int index = indexOf(character);
+		
+		assert(index >= 0);
+		
+		inner_node::erase(keys, children, this->numChildren--, index);
+	}
+	
+	template<typename function> void forEach(function f) {
+		for (unsigned i = 0; i < this->numChildren; i++) {
+			f(keys[i], children[i]);
+		}
+	}
+	
+private:
+	int indexOf(charT character) const {
+#if defined(__SSE2__)
+		if (capacity == 16 && sizeof(charT) <= 4) return indexOf16(character);
+#endif
+		
+		for (unsigned i = 0; i < this->numChildren; i++) {
+			if (keys[i] == character) return i;
+		}
+		
+		return -1;
+	}
+	
+#if defined(__SSE2__)
+	// Compares all 16 keys at once; each matching key sets sizeof(charT) consecutive bits of the mask
+	int indexOf16(charT character) const {
+		const __m128i* blocks = reinterpret_cast<const __m128i*>(keys);
+		
+		unsigned long long mask = 0;
+		
+		for (unsigned i = 0; i < sizeof(charT); i++) {
+			__m128i block = _mm_loadu_si128(blocks + i);
+			__m128i matches;
+			
+			if (sizeof(charT) == 1) {
+				matches = _mm_cmpeq_epi8(block, _mm_set1_epi8(static_cast<char>(character)));
+			} else if (sizeof(charT) == 2) {
+				matches = _mm_cmpeq_epi16(block, _mm_set1_epi16(static_cast<short>(character)));
+			} else {
+				matches = _mm_cmpeq_epi32(block, _mm_set1_epi32(static_cast<int>(character)));
+			}
+			
+			mask |= static_cast<unsigned long long>(_mm_movemask_epi8(matches)) << (16 * i);
+		}
+		
+		unsigned usedBits = this->numChildren * sizeof(charT);
+		if (usedBits < 64) mask &= (1ULL << usedBits) - 1;
+		
+		return mask ? static_cast<int>(__builtin_ctzll(mask) / sizeof(charT)) : -1;
+	}
+#endif
+};
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::node48 : inner_node {
+	unsigned char childIndex[256];  // one-based index into children, 0 if there is no child
+	node* children[48];
+	typename inner_node::leaf_counts leafCounts;
+	
+	
+	node48(typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) : inner_node(node::node48Kind, compareIndex, representative), childIndex(), children(), leafCounts() {}
+	
+	
+	node** find(charT character) {
+		unsigned char index = childIndex[inner_node::slotOf(character)];
+		
+		return index ? &children[index - 1] : nullptr;
+	}
+	
+	node* firstChild(charT& character) const {
+		return childAfter(-1, character);
+	}
+	
+	node* lastChild(charT& character) const {
+		return childBefore(256, character);
+	}
+	
+	node* nextChild(charT& character) const {
+		return childAfter(inner_node::slotOf(character), character);
+	}
+	
+	node* previousChild(charT& character) const {
+		return childBefore(inner_node::slotOf(character), character);
+	}
+	
+	bool full() const {
+		return this->numChildren == 48;
+	}
+	
+	void insert(charT character, node* child) {
+		assert(!full());
+		
+		unsigned index = 0;
+		while (children[index]) index++;
+		
+		children[index] = child;
+		childIndex[inner_node::slotOf(character)] = index + 1;
+		leafCounts.add(inner_node::slotOf(character), static_cast<unsigned>(numLeavesOf(*child)));
+		
+		this->numChildren++;
+	}
+	
+	void erase(charT character) {
+		unsigned char& index = childIndex[inner_node::slotOf(character)];
+		
+		assert(index);
+		
+		leafCounts.subtract(inner_node::slotOf(character), static_cast<unsigned>(numLeavesOf(*children[index - 1])));
+		
+		children[index - 1] = nullptr;
+		index = 0;
+		
+		this->numChildren--;
+	}
+	
+	template<typename function> void forEach(function f) {
+		for (unsigned slot = 0; slot < 256; slot++) {
+			if (childIndex[slot]) f(inner_node::characterOf(slot), children[childIndex[slot] - 1]);
+		}
+	}
+	
+	
+	// The groups before character's come from leafCounts, the rest of its group from the children themselves
+	size_t numLeavesBefore(charT character) const {
+		unsigned slot = inner_node::slotOf(character);
+		size_t numLeaves = leafCounts.before(slot);
+		
+		for (unsigned otherSlot = slot & ~3u; otherSlot < slot; otherSlot++) {
+			if (childIndex[otherSlot]) numLeaves += numLeavesOf(*children[childIndex[otherSlot] - 1]);
+		}
+		
+		return numLeaves;
+	}
+	
+	node* childHolding(size_t& index, charT& character) const {
+		for (unsigned slot = leafCounts.find(index); ; slot++) {
+			if (!childIndex[slot]) continue;
+			
+			node* child = children[childIndex[slot] - 1];
+			
+			if (index < numLeavesOf(*child)) {
+				character = inner_node::characterOf(slot);
+				
+				return child;
+			}
+			
+			index -= numLeavesOf(*child);
+		}
+	}
+	
+	void leafAdded(charT character) {
+		leafCounts.add(inner_node::slotOf(character), 1);
+	}
+	
+	void leafRemoved(charT character) {
+		leafCounts.subtract(inner_node::slotOf(character), 1);
+	}
+	
+private:
+	node* childAfter(int slot, charT& character) const {
+		for (slot++; slot < 256; slot++) {
+			if (childIndex[slot]) {
+				character = inner_node::characterOf(slot);
+				
+				return children[childIndex[slot] - 1];
+			}
+		}
+		
+		return nullptr;
+	}
+	
+	node* childBefore(int slot, charT& character) const {
+		for (slot--; slot >= 0; slot--) {
+			if (childIndex[slot]) {
+				character = inner_node::characterOf(slot);
+				
+				return children[childIndex[slot] - 1];
+			}
+		}
+		
+		return nullptr;
+	}
+};
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::node256 : inner_node {
+	node* children[256];
+	typename inner_node::leaf_counts leafCounts;
+	
+	
+	node256(typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) : inner_node(node::node256Kind, compareIndex, representative), children(), leafCounts() {}
+	
+	
+	node** find(charT character) {
+		node** child = &children[inner_node::slotOf(character)];
+		
+		return *child ? child : nullptr;
+	}
+	
+	node* firstChild(charT& character) const {
+		return childAfter(-1, character);
+	}
+	
+	node* lastChild(charT& character) const {
+		return childBefore(256, character);
+	}
+	
+	node* nextChild(charT& character) const {
+		return childAfter(inner_node::slotOf(character), character);
+	}
+	
+	node* previousChild(charT& character) const {
+		return childBefore(inner_node::slotOf(character), character);
+	}
+	
+	bool full() const {
+		return false;
+	}
+	
+	void insert(charT character, node* child) {
+		children[inner_node::slotOf(character)] = child;
+		leafCounts.add(inner_node::slotOf(character), static_cast<unsigned>(numLeavesOf(*child)));
+		
+		this->numChildren++;
+	}
+	
+	void erase(charT character) {
+		node*& child = children[inner_node::slotOf(character)];
+		
+		leafCounts.subtract(inner_node::slotOf(character), static_cast<unsigned>(numLeavesOf(*child)));
+		child = nullptr;
+		
+		this->numChildren--;
+	}
+	
+	template<typename function> void forEach(function f) {
+		for (unsigned slot = 0; slot < 256; slot++) {
+			if (children[slot]) f(inner_node::characterOf(slot), children[slot]);
+		}
+	}
+	
+	
+	size_t numLeavesBefore(charT character) const {
+		unsigned slot = inner_node::slotOf(character);
+		size_t numLeaves = leafCounts.before(slot);
+		
+		for (unsigned otherSlot = slot & ~3u; otherSlot < slot; otherSlot++) {
+			if (children[otherSlot]) numLeaves += numLeavesOf(*children[otherSlot]);
+		}
+		
+		return numLeaves;
+	}
+	
+	node* childHolding(size_t& index, charT& character) const {
+		for (unsigned slot = leafCounts.find(index); ; slot++) {
+			if (!children[slot]) continue;
+			
+			if (index < numLeavesOf(*children[slot])) {
+				character = inner_node::characterOf(slot);
+				
+				return children[slot];
+			}
+			
+			index -= numLeavesOf(*children[slot]);
+		}
+	}
+	
+	void leafAdded(charT character) {
+		leafCounts.add(inner_node::slotOf(character), 1);
+	}
+	
+	void leafRemoved(charT character) {
+		leafCounts.subtract(inner_node::slotOf(character), 1);
+	}
+	
+private:
+	node* childAfter(int slot, charT& character) const {
+		for (slot++; slot < 256; slot++) {
+			if (children[slot]) {
+				character = inner_node::characterOf(slot);
+				
+				return children[slot];
+			}
+		}
+		
+		return nullptr;
+	}
+	
+	node* childBefore(int slot, charT& character) const {
+		for (slot--; slot >= 0; slot--) {
+			if (children[slot]) {
+				character = inner_node::characterOf(slot);
+				
+				return children[slot];
+			}
+		}
+		
+		return nullptr;
+	}
+};
+
+
+// Variable-sized: the children and then the keys are stored directly after the node
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::sparse_node : inner_node {
+	unsigned capacity;
+	
+	
+	sparse_node(typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative, unsigned capacity) : inner_node(node::sparseKind, compareIndex, representative), capacity(capacity) {}
+	
+	
+	static size_t allocationSize(unsigned capacity) {
+		return sizeof(sparse_node) + capacity * (sizeof(node*) + sizeof(charT));
+	}
+	
+	node** children() {
+		return reinterpret_cast<node**>(this + 1);
+	}
+	
+	node* const* children() const {
+		return reinterpret_cast<node* const*>(this + 1);
+	}
+	
+	charT* keys() {
+		return reinterpret_cast<charT*>(children() + capacity);
+	}
+	
+	const charT* keys() const {
+		return reinterpret_cast<const charT*>(children() + capacity);
+	}
+	
+	
+	node** find(charT character) {
+		unsigned i = inner_node::lowerBound(keys(), this->numChildren, character);
+		
+		return (i < this->numChildren && keys()[i] == character) ? &children()[i] : nullptr;
+	}
+	
+	node* firstChild(charT& character) const {
+		character = keys()[0];
+		
+		return children()[0];
+	}
+	
+	node* lastChild(charT& character) const {
+		character = keys()[this->numChildren - 1];
+		
+		return children()[this->numChildren - 1];
+	}
+	
+	node* nextChild(charT& character) const {
+		return inner_node::nextChild(keys(), children(), this->numChildren, character);
+	}
+	
+	node* previousChild(charT& character) const {
+		return inner_node::previousChild(keys(), children(), this->numChildren, character);
+	}
+	
+	bool full() const {
+		return this->numChildren == capacity;
+	}
+	
+	void insert(charT character, node* child) {
+		assert(!full());
+		
+		inner_node::insert(keys(), children(), this->numChildren++, character, child);
+	}
+	
+	void erase(charT character) {
+		unsigned i = inner_node::lowerBound(keys(), this->numChildren, character);
+		
+		assert(i < this->numChildren && keys()[i] == character);
+		
+		inner_node::erase(keys(), children(), this->numChildren--, i);
+	}
+	
+	template<typename function> void forEach(function f) {
+		for (unsigned i = 0; i < this->numChildren; i++) {
+			f(keys()[i], children()[i]);
+		}
+	}
+};
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::node::allocationSize() const {
+	switch (kind) {
+		case leafKind: return sizeof(leaf_node);
+		case node2Kind: return sizeof(node2);
+		case node4Kind: return sizeof(node4);
+		case node16Kind: return sizeof(node16);
+		case node48Kind: return sizeof(node48);
+		case node256Kind: return sizeof(node256);
+		default: return sparse_node::allocationSize(static_cast<const sparse_node*>(this)->capacity);
+	}
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::find(charT character) -> node** {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<node2*>(this)->find(character);
+		case node::node4Kind: return static_cast<node4*>(this)->find(character);
+		case node::node16Kind: return static_cast<node16*>(this)->find(character);
+		case node::node48Kind: return static_cast<node48*>(this)->find(character);
+		case node::node256Kind: return static_cast<node256*>(this)->find(character);
+		default: return static_cast<sparse_node*>(this)->find(character);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::firstChild(charT& character) const -> node* {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<const node2*>(this)->firstChild(character);
+		case node::node4Kind: return static_cast<const node4*>(this)->firstChild(character);
+		case node::node16Kind: return static_cast<const node16*>(this)->firstChild(character);
+		case node::node48Kind: return static_cast<const node48*>(this)->firstChild(character);
+		case node::node256Kind: return static_cast<const node256*>(this)->firstChild(character);
+		default: return static_cast<const sparse_node*>(this)->firstChild(character);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::lastChild(charT& character) const -> node* {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<const node2*>(this)->lastChild(character);
+		case node::node4Kind: return static_cast<const node4*>(this)->lastChild(character);
+		case node::node16Kind: return static_cast<const node16*>(this)->lastChild(character);
+		case node::node48Kind: return static_cast<const node48*>(this)->lastChild(character);
+		case node::node256Kind: return static_cast<const node256*>(this)->lastChild(character);
+		default: return static_cast<const sparse_node*>(this)->lastChild(character);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::nextChild(charT& character) const -> node* {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<const node2*>(this)->nextChild(character);
+		case node::node4Kind: return static_cast<const node4*>(this)->nextChild(character);
+		case node::node16Kind: return static_cast<const node16*>(this)->nextChild(character);
+		case node::node48Kind: return static_cast<const node48*>(this)->nextChild(character);
+		case node::node256Kind: return static_cast<const node256*>(this)->nextChild(character);
+		default: return static_cast<const sparse_node*>(this)->nextChild(character);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::previousChild(charT& character) const -> node* {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<const node2*>(this)->previousChild(character);
+		case node::node4Kind: return static_cast<const node4*>(this)->previousChild(character);
+		case node::node16Kind: return static_cast<const node16*>(this)->previousChild(character);
+		case node::node48Kind: return static_cast<const node48*>(this)->previousChild(character);
+		case node::node256Kind: return static_cast<const node256*>(this)->previousChild(character);
+		default: return static_cast<const sparse_node*>(this)->previousChild(character);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool string_trie<charT, reservedChar, binaryKeys>::inner_node::full() const {
+	switch (this->kind) {
+		case node::node2Kind: return static_cast<const node2*>(this)->full();
+		case node::node4Kind: return static_cast<const node4*>(this)->full();
+		case node::node16Kind: return static_cast<const node16*>(this)->full();
+		case node::node48Kind: return static_cast<const node48*>(this)->full();
+		case node::node256Kind: return static_cast<const node256*>(this)->full();
+		default: return static_cast<const sparse_node*>(this)->full();
+	}
+}
+
+// The thresholds leave some slack below the next smaller kind so that a node does not flip back and forth
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool string_trie<charT, reservedChar, binaryKeys>::inner_node::underfull() const {
+	switch (this->kind) {
+		case node::node2Kind: return false;
+		case node::node4Kind: return numChildren <= 1;
+		case node::node16Kind: return numChildren <= 3;
+		case node::node48Kind: return numChildren <= 12;
+		case node::node256Kind: return numChildren <= 37;
+		default: {
+			unsigned capacity = static_cast<const sparse_node*>(this)->capacity;
+			
+			return capacity == 32 ? numChildren <= 12 : numChildren <= capacity / 4;
+		}
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::inner_node::insert(charT character, node* child) {
+	switch (this->kind) {
+		case node::node2Kind: static_cast<node2*>(this)->insert(character, child); break;
+		case node::node4Kind: static_cast<node4*>(this)->insert(character, child); break;
+		case node::node16Kind: static_cast<node16*>(this)->insert(character, child); break;
+		case node::node48Kind: static_cast<node48*>(this)->insert(character, child); break;
+		case node::node256Kind: static_cast<node256*>(this)->insert(character, child); break;
+		default: static_cast<sparse_node*>(this)->insert(character, child); break;
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::inner_node::erase(charT character) {
+	switch (this->kind) {
+		case node::node2Kind: static_cast<node2*>(this)->erase(character); break;
+		case node::node4Kind: static_cast<node4*>(this)->erase(character); break;
+		case node::node16Kind: static_cast<node16*>(this)->erase(character); break;
+		case node::node48Kind: static_cast<node48*>(this)->erase(character); break;
+		case node::node256Kind: static_cast<node256*>(this)->erase(character); break;
+		default: static_cast<sparse_node*>(this)->erase(character); break;
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<typename function>
+void string_trie<charT, reservedChar, binaryKeys>::inner_node::forEach(function f) {
+	switch (this->kind) {
+		case node::node2Kind: static_cast<node2*>(this)->forEach(f); break;
+		case node::node4Kind: static_cast<node4*>(this)->forEach(f); break;
+		case node::node16Kind: static_cast<node16*>(this)->forEach(f); break;
+		case node::node48Kind: static_cast<node48*>(this)->forEach(f); break;
+		case node::node256Kind: static_cast<node256*>(this)->forEach(f); break;
+		default: static_cast<sparse_node*>(this)->forEach(f); break;
+	}
+}
+
+// Only node48 and node256 keep leaf counts; the other kinds add up their children, at most 16 but for sparse nodes
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::inner_node::numLeavesBefore(charT character) const {
+	switch (this->kind) {
+		case node::node48Kind: return static_cast<const node48*>(this)->numLeavesBefore(character);
+		case node::node256Kind: return static_cast<const node256*>(this)->numLeavesBefore(character);
+		default: {
+			size_t numLeaves = 0;
+			
+			forEach([character, &numLeaves](charT childCharacter, node* child) {
+				if (less(childCharacter, character)) numLeaves += numLeavesOf(*child);
+			});
+			
+			return numLeaves;
+		}
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inner_node::childHolding(size_t& index, charT& character) const -> node* {
+	switch (this->kind) {
+		case node::node48Kind: return static_cast<const node48*>(this)->childHolding(index, character);
+		case node::node256Kind: return static_cast<const node256*>(this)->childHolding(index, character);
+		default: {
+			node* child = firstChild(character);
+			
+			while (index >= numLeavesOf(*child)) {
+				index -= numLeavesOf(*child);
+				child = nextChild(character);
+				
+				assert(child);
+			}
+			
+			return child;
+		}
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::inner_node::leafAdded(charT character) {
+	switch (this->kind) {
+		case node::node48Kind: static_cast<node48*>(this)->leafAdded(character); break;
+		case node::node256Kind: static_cast<node256*>(this)->leafAdded(character); break;
+		default: break;
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::inner_node::leafRemoved(charT character) {
+	switch (this->kind) {
+		case node::node48Kind: static_cast<node48*>(this)->leafRemoved(character); break;
+		case node::node256Kind: static_cast<node256*>(this)->leafRemoved(character); break;
+		default: break;
+	}
+}
+
+
+/* string_trie node pool */
+
+// Hands out node storage from large slabs, recycling freed blocks through one free list per size class. Oversized
+// blocks (only very wide sparse nodes) go straight to the global allocator. Nodes are trivially destructible, so
+// release() can drop every node at once.
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+class string_trie<charT, reservedChar, binaryKeys>::node_pool {
+public:
+	node_pool() : slabs_(), largeBlocks_(), freeLists_(), next_(nullptr), remaining_(0) {}
+	
+	~node_pool() {
+		release();
+	}
+	
+	
+	void* allocate(size_t size) {
+		STRING_TRIE_COUNT(nodeAllocations, 1);
+		
+		if (size >= largeSize) {
+			STRING_TRIE_COUNT(systemAllocations, 1);
+			
+			largeBlocks_.push_back(std::make_pair(::operator new(size), size));
+			
+			return largeBlocks_.back().first;
+		}
+		
+		
+		size_t sizeClass = (size + granularity - 1) / granularity;
+		
+		if (sizeClass < freeLists_.size() && freeLists_[sizeClass]) {
+			free_block* block = freeLists_[sizeClass];
+			freeLists_[sizeClass] = block->next;
+			
+			return block;
+		}
+		
+		
+		size_t blockSize = sizeClass * granularity;
+		
+		if (remaining_ < blockSize) {
+			STRING_TRIE_COUNT(systemAllocations, 1);
+			
+			next_ = static_cast<char*>(::operator new(slabSize));
+			remaining_ = slabSize;
+			
+			slabs_.push_back(next_);
+		}
+		
+		void* block = next_;
+		
+		next_ += blockSize;
+		remaining_ -= blockSize;
+		
+		return block;
+	}
+	
+	void deallocate(void* pointer, size_t size) {
+		STRING_TRIE_COUNT(nodeDeallocations, 1);
+		
+		if (size >= largeSize) {
+			auto i = std::find(largeBlocks_.begin(), largeBlocks_.end(), std::make_pair(pointer, size));
+			
+			assert(i != largeBlocks_.end());
+			
+			largeBlocks_.erase(i);
+			::operator delete(pointer);
+			
+			return;
+		}
+		
+		
+		size_t sizeClass = (size + granularity - 1) / granularity;
+		
+		if (sizeClass >= freeLists_.size()) freeLists_.resize(sizeClass + 1, nullptr);
+		
+		free_block* block = static_cast<free_block*>(pointer);
+		block->next = freeLists_[sizeClass];
+		freeLists_[sizeClass] = block;
+	}
+	
+	// Returns all memory to the system, invalidating every block handed out
+	void release() {
+		for (void* slab : slabs_) {
+			::operator delete(slab);
+		}
+		
+		for (const auto& block : largeBlocks_) {
+			::operator delete(block.first);
+		}
+		
+		std::vector<void*>().swap(slabs_);
+		std::vector<std::pair<void*, size_t>>().swap(largeBlocks_);
+		std::vector<free_block*>().swap(freeLists_);
+		
+		next_ = nullptr;
+		remaining_ = 0;
+	}
+	
+	// Bytes held from the system, including free blocks and bookkeeping
+	size_t memoryUsage() const {
+		size_t usage = slabs_.size() * slabSize;
+		
+		for (const auto& block : largeBlocks_) {
+			usage += block.second;
+		}
+		
+		usage += slabs_.capacity() * sizeof(void*);
+		usage += largeBlocks_.capacity() * sizeof(std::pair<void*, size_t>);
+		usage += freeLists_.capacity() * sizeof(free_block*);
+		
+		return usage;
+	}
+	
+	
+	// Takes over every block of otherPool, which is left empty
+	void merge(node_pool& otherPool) {
+		slabs_.insert(slabs_.end(), otherPool.slabs_.begin(), otherPool.slabs_.end());
+		largeBlocks_.insert(largeBlocks_.end(), otherPool.largeBlocks_.begin(), otherPool.largeBlocks_.end());
+		
+		if (freeLists_.size() < otherPool.freeLists_.size()) freeLists_.resize(otherPool.freeLists_.size(), nullptr);
+		
+		for (size_t sizeClass = 0; sizeClass < otherPool.freeLists_.size(); sizeClass++) {
+			while (free_block* block = otherPool.freeLists_[sizeClass]) {
+				otherPool.freeLists_[sizeClass] = block->next;
+				
+				block->next = freeLists_[sizeClass];
+				freeLists_[sizeClass] = block;
+			}
+		}
+		
+		otherPool.slabs_.clear();
+		otherPool.largeBlocks_.clear();
+		otherPool.next_ = nullptr;
+		otherPool.remaining_ = 0;
+	}
+	
+	
+	static void swap(node_pool& pool1, node_pool& pool2) {
+		using std::swap;
+		
+		swap(pool1.slabs_, pool2.slabs_);
+		swap(pool1.largeBlocks_, pool2.largeBlocks_);
+		swap(pool1.freeLists_, pool2.freeLists_);
+		swap(pool1.next_, pool2.next_);
+		swap(pool1.remaining_, pool2.remaining_);
+	}
+	
+private:
+	struct free_block {
+		free_block* next;
+	};
+	
+	
+	static const size_t granularity = 8;
+	static const size_t slabSize = 64 * 1024;
+	static const size_t largeSize = slabSize / 4;
+	
+	
+	std::vector<void*> slabs_;
+	std::vector<std::pair<void*, size_t>> largeBlocks_;
+	std::vector<free_block*> freeLists_;  // indexed by size class
+	
+	char* next_;
+	size_t remaining_;
+	
+	
+	node_pool(const node_pool& otherPool);
+	
+	node_pool& operator=(const node_pool& otherPool);
+};
+
+
+// An inner node of a bulk load whose children are still being collected
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::build_frame {
+	typename std::basic_string<charT>::size_type compareIndex;
+	leaf_node* terminal;
+	std::vector<std::pair<charT, node*>> children;
+};
+
+
+// A string of a batch lookup on its way down the trie
+template<typename charT, charT reservedChar, bool binaryKeys>
+struct string_trie<charT, reservedChar, binaryKeys>::batch_lane {
+	enum lane_stage {
+		descending,
+		loadingKey,  // the leaf is being loaded so that its key can be
+		comparing  // the key is loaded
+	};
+	
+	
+	size_t index;  // of the string in the batch
+	std::basic_string_view<charT> string;
+	
+	const node* current;
+	const leaf_node* leaf;  // the key current is compared against
+	lane_stage stage;
+};
+
+
+/* string_trie */
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie<charT, reservedChar, binaryKeys>::string_trie() : root_(nullptr), size_(0), pool_(), keys_(), deadKeyLength_(0) {
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie<charT, reservedChar, binaryKeys>::string_trie(const string_trie& otherTrie) : string_trie() {
+	keys_.reserve(otherTrie.keys_.size() - otherTrie.deadKeyLength_);
+	
+	
+	// Avoid recursion as we may have very many levels
+	std::stack<inner_node*> nodes;
+	std::vector<inner_node*> copiedNodes;
+	
+	if (otherTrie.root_) {
+		root_ = cloneNode(*otherTrie.root_, otherTrie);
+		
+		if (!root_->isLeaf()) nodes.push(static_cast<inner_node*>(root_));
+	}
+	
+	while (!nodes.empty()) {
+		inner_node* node = nodes.top();
+		nodes.pop();
+		
+		copiedNodes.push_back(node);
+		
+		// The clone still points at the other trie's children; replace each with its own copy
+		node->forEach([this, &nodes, &otherTrie](charT, struct node*& child) {
+			child = cloneNode(*child, otherTrie);
+			
+			if (!child->isLeaf()) nodes.push(static_cast<inner_node*>(child));
+		});
+		
+		if (node->hasTerminal) node->setTerminal(static_cast<leaf_node*>(cloneNode(*node->representative, otherTrie)));
+	}
+	
+	// Children were copied after their parents, so going backwards every child has its representative by the time its
+	// parent borrows it
+	for (auto i = copiedNodes.rbegin(); i != copiedNodes.rend(); i++) {
+		if (!(*i)->hasTerminal) (*i)->representative = &representativeOf(*(*i)->first());
+	}
+	
+	size_ = otherTrie.size_;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie<charT, reservedChar, binaryKeys>::string_trie(string_trie&& otherTrie) : string_trie() {
+	swap(*this, otherTrie);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<typename inputIterator>
+string_trie<charT, reservedChar, binaryKeys>::string_trie(inputIterator first, inputIterator last, unsigned numThreads) : string_trie() {
+	// Copy the keys into the arena first; the nodes are then built from the arena alone
+	std::vector<size_t> offsets;
+	
+	for (; first != last; ++first) {
+		const auto& value = *first;  // keeps a temporary alive while string views it
+		std::basic_string_view<charT> string(value);
+		
+		validateString(string);
+		validateLength(string);
+		
+		if (!offsets.empty()) {
+			std::basic_string_view<charT> previous(keys_.data() + offsets.back(), keys_.size() - offsets.back());
+			
+			int order = previous.compare(string);
+			
+			if (order == 0) continue;  // duplicate
+			if (order > 0) throw std::invalid_argument("Strings must be sorted.");
+		}
+		
+		if (offsets.size() == leafCountLimit) throw std::length_error("Too many strings.");
+		
+		offsets.push_back(keys_.size());
+		
+		keys_.insert(keys_.end(), string.begin(), string.end());
+	}
+	
+	if (offsets.empty()) return;
+	
+	
+	size_ = offsets.size();
+	
+	offsets.push_back(keys_.size());  // so that every key's length is the distance to the next offset
+	
+	if (numThreads > 1) {
+		buildSortedInParallel(offsets, numThreads);
+	} else {
+		root_ = buildSorted(offsets.data(), size_, pool_);
+	}
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie<charT, reservedChar, binaryKeys>::~string_trie() {
+	clear();
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie<charT, reservedChar, binaryKeys>& string_trie<charT, reservedChar, binaryKeys>::operator=(string_trie otherTrie) {
+	swap(*this, otherTrie);
+	
+	return *this;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::cbegin() const -> const_iterator {
+	const_iterator iterator(*this);
+	
+	if (root_) iterator.descendLeftmost(root_);
+	
+	return iterator;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::cend() const -> const_iterator {
+	return const_iterator(*this);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::crbegin() const -> const_reverse_iterator {
+	return const_reverse_iterator(--cend());
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::crend() const -> const_reverse_iterator {
+	return const_reverse_iterator(cend());
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::inserter() -> insert_iterator {
+	return insert_iterator(*this);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<typename inputIterator>
+void string_trie<charT, reservedChar, binaryKeys>::assignSorted(inputIterator first, inputIterator last, unsigned numThreads) {
+	string_trie trie(first, last, numThreads);
+	
+	swap(*this, trie);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::clear() {
+	// Nodes need no destruction, so they can all go back to the system at once
+	root_ = nullptr;
+	size_ = 0;
+	
+	pool_.release();
+	
+	std::vector<charT>().swap(keys_);
+	deadKeyLength_ = 0;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool string_trie<charT, reservedChar, binaryKeys>::empty() const {
+	return size_ == 0;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::size() const {
+	return size_;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::memoryUsage() const {
+	return sizeof(*this) + pool_.memoryUsage() + keys_.capacity() * sizeof(charT);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::insert(std::basic_string_view<charT> string) {
+	validateString(string);
+	validateLength(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	std::vector<node*> nodes = searchPath(string);
+	
+	if (!nodes.empty()) {  // if node found
+		node* node = nodes.back();
+		
+		typename std::basic_string<charT>::size_type compareIndex = indexOfFirstDifference(string, *node);
+		
+		if (compareIndex != std::basic_string<charT>::npos) {  // if the strings are not the same
+			if (size_ == leafCountLimit) throw std::length_error("Trie is full.");
+			
+			// Read both sides of the difference before the new key is appended, as that may move the key arena (which
+			// string could be a view of). At most one side ends at compareIndex.
+			const leaf_node& existingLeaf = representativeOf(*node);
+			
+			const bool existingNodeEnds = existingLeaf.length == compareIndex;
+			const charT existingNodeCharacter = existingNodeEnds ? charT() : keyOf(existingLeaf)[compareIndex];
+			
+			const bool newNodeEnds = string.length() == compareIndex;
+			const charT newNodeCharacter = newNodeEnds ? charT() : string[compareIndex];
+			
+			// The new leaf goes under every inner node of the path that branches at or before compareIndex. Count it now,
+			// while the path still points at them; a node that grows carries its count over. Above compareIndex, it also
+			// goes under the child the path takes (at compareIndex, it becomes a child itself and is counted as one).
+			for (auto pathNode : nodes) {
+				if (pathNode->isLeaf() || static_cast<inner_node*>(pathNode)->compareIndex > compareIndex) break;
+				
+				inner_node* inner = static_cast<inner_node*>(pathNode);
+				
+				inner->numLeaves++;
+				if (inner->compareIndex < compareIndex) inner->leafAdded(string[inner->compareIndex]);
+			}
+			
+			if (!node->isLeaf() && compareIndex == static_cast<inner_node*>(node)->compareIndex) {  // if node is where we should insert new leaf
+				inner_node* inner = static_cast<inner_node*>(node);
+				inner_node* parent = nodes.size() > 1 ? static_cast<inner_node*>(nodes[nodes.size() - 2]) : nullptr;
+				
+				if (newNodeEnds) {
+					inner->setTerminal(newLeafNode(string));
+				} else {
+					addChild(inner, parent, newNodeCharacter, newLeafNode(string));
+				}
+			} else {  // else, create new internal node and insert it at appropriate position along path
+				struct node* parentOfInternal;
+				struct node* siblingOfInternal = siblingOfNewInternalNode(compareIndex, nodes, &parentOfInternal);
+				
+				leaf_node* leaf = newLeafNode(string);
+				inner_node* internal = newInnerNode(node::node2Kind, 2, compareIndex, leaf);
+				internal->numLeaves = static_cast<unsigned>(numLeavesOf(*siblingOfInternal) + 1);
+				
+				// Set existing node as child of new internal node
+				if (existingNodeEnds) {
+					internal->setTerminal(static_cast<leaf_node*>(siblingOfInternal));
+				} else {
+					internal->insert(existingNodeCharacter, siblingOfInternal);
+				}
+				
+				// Set new leaf node as child of new internal node
+				if (newNodeEnds) {
+					internal->setTerminal(leaf);
+				} else {
+					internal->insert(newNodeCharacter, leaf);
+				}
+				
+				// Set original parent of existing node as parent of internal node
+				replaceChild(static_cast<inner_node*>(parentOfInternal), internal);
+			}
+			
+			size_++;
+		}
+	} else {
+		root_ = newLeafNode(string);
+		
+		size_++;
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::remove(std::basic_string_view<charT> string) {
+	validateString(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	std::vector<node*> nodes = searchPath(string);
+	
+	node* node = nullptr;
+	inner_node* parent = nullptr;
+	inner_node* parentOfParent = nullptr;
+	
+	if (!nodes.empty()) {
+		node = nodes.back();
+		nodes.pop_back();
+	}
+	
+	if (!nodes.empty()) {
+		parent = static_cast<inner_node*>(nodes.back());
+		nodes.pop_back();
+	}
+	
+	if (!nodes.empty()) {
+		parentOfParent = static_cast<inner_node*>(nodes.back());
+	}
+	
+	
+	if (node && node->isLeaf() && indexOfFirstDifference(string, *node) == std::basic_string<charT>::npos) {  // if we found a matching leaf node
+		leaf_node* leaf = static_cast<leaf_node*>(node);
+		
+		if (parent) {
+			// The leaf no longer counts towards any node above it, nor towards the child each of them leads to it through
+			for (auto ancestor : nodes) {
+				inner_node* inner = static_cast<inner_node*>(ancestor);
+				
+				inner->numLeaves--;
+				inner->leafRemoved(keyOf(*leaf)[inner->compareIndex]);
+			}
+			
+			parent->numLeaves--;
+			
+			
+			// Remove reference to removed node from parent
+			if (parent->terminal() == leaf) {
+				parent->hasTerminal = false;
+			} else {
+				parent->erase(keyOf(*leaf)[parent->compareIndex]);
+			}
+			
+			
+			assert(parent->numBranches() > 0);
+			
+			// Ancestors that borrowed the removed leaf as their representative switch to one of its former siblings
+			const leaf_node& replacement = representativeOf(*parent->firstBranch());
+			
+			for (auto ancestor : nodes) {
+				inner_node* inner = static_cast<inner_node*>(ancestor);
+				
+				if (inner->representative == leaf) inner->representative = &replacement;
+			}
+			
+			if (parent->representative == leaf) parent->representative = &replacement;
+			
+			
+			if (parent->numBranches() == 1) {  // if parent only has one child remaining, then delete parent
+				struct node* onlyChild = parent->firstBranch();
+				
+				// If parent has a parent, remove the reference to the parent
+				replaceChild(parentOfParent, onlyChild);
+				
+				assert(!parentOfParent || parentOfParent->numBranches() >= 2);
+				
+				
+				destroyNode(parent);
+			} else if (parent->underfull()) {  // else, move parent to a smaller node kind if it has room to spare
+				replaceChild(parentOfParent, shrinkNode(parent));
+			}
+		} else {
+			root_ = nullptr;
+		}
+		
+		
+		deadKeyLength_ += leaf->length;
+		
+		destroyNode(leaf);
+		
+		size_--;
+		
+		
+		if (!root_) {
+			keys_.clear();
+			deadKeyLength_ = 0;
+		} else if (deadKeyLength_ > minimumCompactionLength && deadKeyLength_ > keys_.size() / 2) {
+			compactKeys();
+		}
+	}
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+bool string_trie<charT, reservedChar, binaryKeys>::contains(std::basic_string_view<charT> string) const {
+	validateString(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	node* node = search(string);
+	
+	return node && node->isLeaf() && indexOfFirstDifference(string, *node) == std::basic_string<charT>::npos;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::predecessor(std::basic_string_view<charT> string) const -> const_iterator {
+	validateString(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	// Stepping back from the first string gives the past-the-end iterator
+	return --lowerBound(string, false);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::successor(std::basic_string_view<charT> string) const -> const_iterator {
+	validateString(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	return lowerBound(string, true);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::containsBatch(const std::basic_string_view<charT>* strings, size_t count, bool* results, unsigned numThreads) const {
+	for (size_t i = 0; i < count; i++) {
+		validateString(strings[i]);
+	}
+	
+	STRING_TRIE_COUNT(queries, count);
+	
+	if (!root_) {
+		std::fill(results, results + count, false);
+		
+		return;
+	}
+	
+	
+	runInParallel(count, numThreads, [&](size_t first, size_t runCount) {
+		auto descend = [](size_t, const inner_node*, std::basic_string_view<charT>) {};
+		
+		auto finish = [&](size_t index, std::basic_string_view<charT> string, const node* node) {
+			results[first + index] = node->isLeaf() && indexOfFirstDifference(string, *node) == std::basic_string<charT>::npos;
+		};
+		
+		walkBatch(strings + first, runCount, descend, finish);
+	});
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::successorBatch(const std::basic_string_view<charT>* strings, size_t count, const_iterator* results, unsigned numThreads) const {
+	for (size_t i = 0; i < count; i++) {
+		validateString(strings[i]);
+	}
+	
+	STRING_TRIE_COUNT(queries, count);
+	
+	
+	runInParallel(count, numThreads, [&](size_t first, size_t runCount) {
+		std::fill(results + first, results + first + runCount, const_iterator(*this));
+		
+		if (!root_) return;
+		
+		
+		auto descend = [&](size_t index, const inner_node* inner, std::basic_string_view<charT> string) {
+			results[first + index].pushToward(inner, string);
+		};
+		
+		auto finish = [&](size_t index, std::basic_string_view<charT> string, const node* node) {
+			results[first + index].finishLowerBound(node, string, true);
+		};
+		
+		walkBatch(strings + first, runCount, descend, finish);
+	});
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::prefixedStrings(std::basic_string_view<charT> prefix) const -> const_range {
+	validateString(prefix);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	const_iterator begin(*this);
+	const_iterator end(*this);
+	
+	if (!begin.seekPrefixed(prefix, end)) return const_range(cend(), cend());
+	
+	return const_range(begin, end);
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::countPrefixed(std::basic_string_view<charT> prefix) const {
+	validateString(prefix);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	if (!root_) return 0;
+	
+	
+	// Same walk as prefixedStrings(): every string below the first node whose path covers the prefix has the prefix
+	const node* node = root_;
+	
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		if (inner->compareIndex >= prefix.length()) break;
+		
+		STRING_TRIE_COUNT(nodesVisited, 1);
+		
+		const struct node* const* child = inner->find(prefix[inner->compareIndex]);
+		
+		if (!child) return 0;
+		
+		node = *child;
+	}
+	
+	
+	const leaf_node& representative = representativeOf(*node);
+	
+	if (representative.length < prefix.length() || !std::equal(prefix.begin(), prefix.end(), keyOf(representative))) return 0;
+	
+	return numLeavesOf(*node);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::rank(std::basic_string_view<charT> string) const {
+	validateString(string);
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	if (!root_) return 0;
+	
+	
+	// Find where string leaves the trie first, as the nodes along the way do not say
+	typename std::basic_string<charT>::size_type index = indexOfFirstDifference(string, *search(string));
+	
+	
+	// Then go down again as far as string agrees with the trie, counting the leaves on the left of the path
+	size_t rank = 0;
+	const node* node = root_;
+	
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		if (inner->compareIndex >= index) break;
+		
+		rank += numLeavesBefore(*inner, string);
+		node = childTowards(*inner, string);
+	}
+	
+	if (index == std::basic_string<charT>::npos) return rank;  // string is the leaf we arrived at
+	
+	
+	// String falls among the children of an inner node it reaches...
+	if (!node->isLeaf() && static_cast<const inner_node*>(node)->compareIndex == index) return rank + numLeavesBefore(*static_cast<const inner_node*>(node), string);
+	
+	// ...or comes before or after the whole subtree, whose strings all compare to it the same way (see string_trie_path::finishLowerBound())
+	const leaf_node& representative = representativeOf(*node);
+	
+	bool less = index == string.length() || (index < representative.length && inner_node::less(string[index], keyOf(representative)[index]));
+	
+	return less ? rank : rank + numLeavesOf(*node);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::select(size_t index) const -> const_iterator {
+	STRING_TRIE_COUNT(queries, 1);
+	
+	
+	const_iterator iterator(*this);
+	
+	if (index >= size_) return iterator;
+	
+	
+	// index counts the strings still to be skipped within node
+	const node* node = root_;
+	
+	while (!node->isLeaf()) {
+		const inner_node* inner = static_cast<const inner_node*>(node);
+		
+		STRING_TRIE_COUNT(nodesVisited, 1);
+		
+		if (inner->hasTerminal) {
+			if (index == 0) {
+				iterator.push(inner, charT(), true);
+				node = inner->terminal();
+				
+				continue;
+			}
+			
+			index--;
+		}
+		
+		charT character = charT();
+		const struct node* child = inner->childHolding(index, character);
+		
+		iterator.push(inner, character);
+		node = child;
+	}
+	
+	iterator.leaf_ = static_cast<const leaf_node*>(node);
+	
+	return iterator;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::search(std::basic_string_view<charT> string) const -> node* {
+	node* node = root_;
+	
+	while (node) {
+		if (node->isLeaf()) break;  // if at a leaf node
+		
+		
+		struct node* child = childTowards(*static_cast<inner_node*>(node), string);
+		
+		if (!child) break;  // if string ends before the node or its character is not found among children
+		
+		
+		node = child;
+	}
+	
+	return node;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::searchPath(std::basic_string_view<charT> string) const -> std::vector<node*> {
+	std::vector<node*> nodes;
+	
+	node* node = root_;
+	
+	while (node) {
+		nodes.push_back(node);
+		
+		
+		if (node->isLeaf()) break;  // if at a leaf node
+		
+		
+		struct node* child = childTowards(*static_cast<inner_node*>(node), string);
+		
+		if (!child) break;  // if string ends before the node or its character is not found among children
+		
+		
+		node = child;
+	}
+	
+	return nodes;
+}
+
+
+// Returns the first string not less than string (greater than string if strict)
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::lowerBound(std::basic_string_view<charT> string, bool strict) const -> const_iterator {
+	const_iterator iterator(*this);
+	
+	iterator.seekLowerBound(string, strict);
+	
+	return iterator;
+}
+
+
+// Walks the strings down the trie batchWidth at a time. descend(index, inner, string) is called for each step the
+// string at index takes, and finish(index, string, node) once it can go no further, by which time node and the key
+// it is compared against have been prefetched. The trie must not be empty.
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<typename descendFunction, typename finishFunction>
+void string_trie<charT, reservedChar, binaryKeys>::walkBatch(const std::basic_string_view<charT>* strings, size_t count, descendFunction descend, finishFunction finish) const {
+	batch_lane lanes[batchWidth];
+	unsigned numLanes = 0;
+	
+	size_t next = 0;  // index of the next string to start
+	
+	auto start = [&](batch_lane& lane) {
+		lane.index = next++;
+		lane.string = strings[lane.index];
+		lane.current = root_;
+		lane.stage = batch_lane::descending;
+	};
+	
+	while (numLanes < batchWidth && next < count) start(lanes[numLanes++]);
+	
+	
+	// Every pass takes each lane one load further. Each load is prefetched on one pass and used on the next, so it has
+	// the rest of the pass to arrive.
+	while (numLanes > 0) {
+		for (unsigned i = 0; i < numLanes; ) {
+			batch_lane& lane = lanes[i];
+			
+			if (lane.stage == batch_lane::descending) {
+				if (!lane.current->isLeaf()) {
+					const inner_node* inner = static_cast<const inner_node*>(lane.current);
+					const node* child = childTowards(*inner, lane.string);
+					
+					if (child) {
+						descend(lane.index, inner, lane.string);
+						
+						lane.current = child;
+						prefetch(child);
+						
+						i++;
+						continue;
+					}
+				}
+				
+				// The string goes no further, so load the key it will be compared against
+				lane.leaf = &representativeOf(*lane.current);
+				
+				if (lane.leaf == lane.current) {
+					prefetch(keyOf(*lane.leaf));
+					lane.stage = batch_lane::comparing;
+				} else {
+					prefetch(lane.leaf);
+					lane.stage = batch_lane::loadingKey;
+				}
+			} else if (lane.stage == batch_lane::loadingKey) {
+				prefetch(keyOf(*lane.leaf));
+				lane.stage = batch_lane::comparing;
+			} else {
+				finish(lane.index, lane.string, lane.current);
+				
+				if (next < count) {
+					start(lane);
+				} else {
+					std::swap(lane, lanes[--numLanes]);  // the last lane takes this one's place in the pass
+					continue;
+				}
+			}
+			
+			i++;
 		}
-		
-		
-		delete node;
 	}
 }
 
-
-template<typename charT, charT reservedChar>
-bool string_trie<charT, reservedChar>::contains(std::basic_string<charT> string) const {
-	normalizeString(string);
+// Splits count strings into at most numThreads runs of at least minimumBatchRunLength, and calls run(first, count)
+// for each run on its own thread
+template<typename charT, charT reservedChar, bool binaryKeys>
+template<typename function>
+void string_trie<charT, reservedChar, binaryKeys>::runInParallel(size_t count, unsigned numThreads, function run) {
+	size_t numRuns = std::max<size_t>(1, std::min<size_t>(numThreads, count / minimumBatchRunLength));
+	size_t runLength = (count + numRuns - 1) / numRuns;
 	
+	std::vector<std::exception_ptr> errors(numRuns);
 	
-	node* node = search(string);
+	auto work = [&](size_t i) {
+		try {
+			size_t first = i * runLength;
+			
+			run(first, std::min(runLength, count - first));
+		} catch (...) {
+			errors[i] = std::current_exception();
+		}
+	};
 	
-	return node && node->string == string;
-}
-
-
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::predecessor(std::basic_string<charT> string) const -> const_iterator {
-	normalizeString(string);
+	std::vector<std::thread> threads;
 	
+	for (size_t i = 1; i < numRuns; i++) {
+		threads.emplace_back(work, i);
+	}
 	
-	std::vector<node*> nodes = searchPath(string);
+	work(0);
 	
-	if (nodes.empty()) return const_iterator(*this);
+	for (auto& thread : threads) {
+		thread.join();
+	}
 	
 	
-	node* last = nodes.back();
-	nodes.pop_back();
+	for (const auto& error : errors) {
+		if (error) std::rethrow_exception(error);
+	}
+}
+
+
+// Builds the subtrie for count consecutive keys of the arena, the i-th of which starts at offsets[i]. Sorted keys
+// only ever extend the rightmost path, so the inner nodes on that path are kept open until a key branches off above
+// them; each is then allocated once, at the size its children need.
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::buildSorted(const size_t* offsets, size_t count, node_pool& pool) const -> node* {
+	std::vector<build_frame> frames;
+	size_t depth = 0;  // frames beyond depth are kept only so their vectors can be reused
 	
-	// If node's string is less than our string, then its rightmost descendant is what we want
-	if (string.compare(last->string) > 0) return const_iterator(*this, rightmostDescendant(*last)->string);
 	
+	const charT* previousKey = nullptr;
+	typename std::basic_string<charT>::size_type previousLength = 0;
 	
-	node* previousNode = last;
-	node* desiredNode = nullptr;
+	node* subtree = nullptr;  // rightmost subtree that has not been added to a frame yet
 	
-	for (auto i = nodes.rbegin(); i != nodes.rend(); i++) {
-		node* node = *i;
-		assert(!node->isLeaf);
+	auto closeFrame = [&]() {
+		build_frame& frame = frames[depth - 1];
 		
+		frame.children.push_back(std::make_pair(previousKey[frame.compareIndex], subtree));
 		
-		// Get iterator pointing to edge going down to previous node
-		const charT& character = previousNode->string[node->compareIndex];
-		auto iter = node->children.find(character);
+		inner_node* inner = newSizedInnerNode(pool, frame.children.size(), frame.compareIndex, &representativeOf(*frame.children.front().second));
 		
-		assert(iter != node->children.end());
+		for (const auto& child : frame.children) {
+			inner->insert(child.first, child.second);
+			inner->numLeaves += static_cast<unsigned>(numLeavesOf(*child.second));
+		}
+		
+		if (frame.terminal) {
+			inner->setTerminal(frame.terminal);
+			inner->numLeaves++;
+		}
+		
+		frame.children.clear();
+		depth--;
 		
+		subtree = inner;
+	};
+	
+	for (size_t i = 0; i < count; i++) {
+		const charT* key = keys_.data() + offsets[i];
+		
+		leaf_node* leaf = new (pool.allocate(sizeof(leaf_node))) leaf_node(offsets[i], static_cast<unsigned>(offsets[i + 1] - offsets[i]));
 		
-		// Get the preceding node if present
-		if (iter != node->children.begin()) {
-			iter--;
+		if (previousKey) {
+			// Keys are distinct and sorted, so they differ before either ends or the previous key is a prefix of this one
+			typename std::basic_string<charT>::size_type index = 0;
+			
+			while (index < previousLength && key[index] == previousKey[index]) index++;
+			
 			
-			if (string.compare(iter->second->string) > 0) {
-				desiredNode = iter->second;
+			while (depth > 0 && frames[depth - 1].compareIndex > index) closeFrame();
+			
+			if (depth == 0 || frames[depth - 1].compareIndex < index) {
+				if (depth == frames.size()) frames.emplace_back();
 				
-				break;
+				frames[depth].compareIndex = index;
+				frames[depth].terminal = nullptr;
+				depth++;
+			}
+			
+			if (index == previousLength) {  // only the previous key can end here, and it is a leaf
+				frames[depth - 1].terminal = static_cast<leaf_node*>(subtree);
+			} else {
+				frames[depth - 1].children.push_back(std::make_pair(previousKey[index], subtree));
 			}
 		}
 		
-		previousNode = node;
+		previousKey = key;
+		previousLength = leaf->length;
+		subtree = leaf;
 	}
 	
-	if (!desiredNode) return const_iterator(*this);
+	while (depth > 0) closeFrame();
 	
-	return const_iterator(*this, rightmostDescendant(*desiredNode)->string);
+	return subtree;
 }
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::successor(std::basic_string<charT> string) const -> const_iterator {
-	normalizeString(string);
+// Builds the subtries for each first character on numThreads threads, each allocating from its own pool, then puts
+// them under the root
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::buildSortedInParallel(const std::vector<size_t>& offsets, unsigned numThreads) {
+	// An empty key has no first character; it becomes the root's terminal leaf instead of a partition
+	const size_t firstKey = offsets[1] == offsets[0] ? 1 : 0;
 	
+	std::vector<size_t> partitions;  // index of the first key of each first character
 	
-	std::vector<node*> nodes = searchPath(string);
+	for (size_t i = firstKey; i < size_; i++) {
+		if (i == firstKey || keys_[offsets[i]] != keys_[offsets[i - 1]]) partitions.push_back(i);
+	}
+	
+	if (partitions.size() <= 1) {
+		root_ = buildSorted(offsets.data(), size_, pool_);
+		
+		return;
+	}
 	
-	if (nodes.empty()) return const_iterator(*this);
+	partitions.push_back(size_);
 	
 	
-	node* last = nodes.back();
-	nodes.pop_back();
+	size_t numPartitions = partitions.size() - 1;
 	
-	// If node's string is greater than our string, then its leftmost descendant is what we want
-	if (string.compare(last->string) < 0) return const_iterator(*this, leftmostDescendant(*last)->string);
+	numThreads = static_cast<unsigned>(std::min<size_t>(numThreads, numPartitions));
 	
+	std::vector<node*> subtries(numPartitions, nullptr);
+	std::vector<node_pool> pools(numThreads);
+	std::vector<std::exception_ptr> errors(numThreads);
 	
-	node* previousNode = last;
-	node* desiredNode = nullptr;
+	std::atomic<size_t> nextPartition(0);
 	
-	for (auto i = nodes.rbegin(); i != nodes.rend(); i++) {
-		node* node = *i;
-		assert(!node->isLeaf);
-		
-		
-		// Get iterator pointing to edge following edge going down to previous node
-		const charT& character = previousNode->string[node->compareIndex];
-		auto iter = node->children.upper_bound(character);
-		
-		
-		if (iter != node->children.end() && string.compare(iter->second->string) < 0) {
-			desiredNode = iter->second;
-			
-			break;
+	auto work = [&](unsigned thread) {
+		try {
+			// Partitions can be very uneven, so threads take the next one as they become free
+			for (size_t i = nextPartition++; i < numPartitions; i = nextPartition++) {
+				subtries[i] = buildSorted(offsets.data() + partitions[i], partitions[i + 1] - partitions[i], pools[thread]);
+			}
+		} catch (...) {
+			errors[thread] = std::current_exception();
 		}
-		
-		previousNode = node;
-	}
-	
-	if (!desiredNode) return const_iterator(*this);
+	};
 	
-	return const_iterator(*this, leftmostDescendant(*desiredNode)->string);
-}
-
-
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::prefixedStrings(std::basic_string<charT> prefix) const -> std::pair<const_iterator, const_iterator> {
-	normalizeString(prefix);
+	std::vector<std::thread> threads;
 	
+	for (unsigned thread = 1; thread < numThreads; thread++) {
+		threads.emplace_back(work, thread);
+	}
 	
-	node* node = search(prefix);
+	work(0);
 	
-	if (!node) return std::pair<const_iterator, const_iterator>(cend(), cend());
+	for (auto& thread : threads) {
+		thread.join();
+	}
 	
 	
-	// If found node has the specified prefix
-	if (node->string.rfind(prefix, prefix.length() - 2) == std::basic_string<charT>::npos) return std::pair<const_iterator, const_iterator>(cend(), cend());
+	// Even on failure the pools must be merged so that every node is freed with the trie
+	for (auto& pool : pools) {
+		pool_.merge(pool);
+	}
 	
+	for (const auto& error : errors) {
+		if (error) std::rethrow_exception(error);
+	}
 	
-	const struct node* leftmost = leftmostDescendant(*node);
-	const struct node* rightmost = rightmostDescendant(*node);
 	
+	inner_node* root = newSizedInnerNode(pool_, numPartitions, 0, &representativeOf(*subtries.front()));
 	
-	const_iterator begin = const_iterator(*this, leftmost->string);
+	for (size_t i = 0; i < numPartitions; i++) {
+		root->insert(keys_[offsets[partitions[i]]], subtries[i]);
+	}
 	
+	if (firstKey > 0) root->setTerminal(new (pool_.allocate(sizeof(leaf_node))) leaf_node(offsets[0], 0));
 	
-	// Get node after rightmost node
-	std::basic_string<charT> lastString = rightmost->string.substr(0, rightmost->string.length() - 1);
+	root->numLeaves = static_cast<unsigned>(size_);
 	
-	const_iterator end = successor(lastString);
+	root_ = root;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::siblingOfNewInternalNode(typename std::basic_string<charT>::size_type compareIndex, const std::vector<struct node*>& nodesInSearchPath, node** parentRef) const -> node* {
+	node* parent = nullptr;
+	node* node = nullptr;
 	
+	for (typename std::vector<struct node*>::const_reverse_iterator i = nodesInSearchPath.rbegin(); i != nodesInSearchPath.rend(); i++) {
+		node = *i;
+		parent = (i == nodesInSearchPath.rend() - 1) ? nullptr : *(i + 1);
+		
+		assert(!parent || static_cast<inner_node*>(parent)->compareIndex != compareIndex);
+		
+		if (parent && static_cast<inner_node*>(parent)->compareIndex < compareIndex) break;
+	}
 	
-	return std::pair<const_iterator, const_iterator>(begin, end);
+	if (parentRef) *parentRef = parent;
+	return node;
 }
 
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::search(const std::basic_string<charT>& string) const -> node* {
-	typename std::basic_string<charT>::size_type length = string.length();
+// Appends string to the key arena. string may itself be a view of the arena, e.g. a key taken from an iterator.
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::newLeafNode(std::basic_string_view<charT> string) -> leaf_node* {
+	assert(string.length() <= maximumKeyLength());
 	
+	size_t offset = keys_.size();
 	
-	node* node = root_;
+	std::less<const charT*> before;
 	
-	while (node) {
-		if (node->isLeaf) break;  // if at a leaf node
-		
-		
-		typename std::basic_string<charT>::size_type compareIndex = node->compareIndex;
+	if (!string.empty() && !keys_.empty() && !before(string.data(), keys_.data()) && before(string.data(), keys_.data() + keys_.size())) {
+		size_t source = string.data() - keys_.data();
 		
-		if (compareIndex > length) break;  // if the index we are looking at is past the end of the string
-		
-		const charT& character = string[compareIndex];
+		keys_.resize(offset + string.length());
+		std::copy(keys_.begin() + source, keys_.begin() + source + string.length(), keys_.begin() + offset);
+	} else {
+		keys_.insert(keys_.end(), string.begin(), string.end());
+	}
+	
+	return new (pool_.allocate(sizeof(leaf_node))) leaf_node(offset, static_cast<unsigned>(string.length()));
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::newInnerNode(typename node::node_kind kind, unsigned capacity, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) -> inner_node* {
+	return newInnerNode(pool_, kind, capacity, compareIndex, representative);
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::newInnerNode(node_pool& pool, typename node::node_kind kind, unsigned capacity, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) -> inner_node* {
+	switch (kind) {
+		case node::node2Kind: return new (pool.allocate(sizeof(node2))) node2(compareIndex, representative);
+		case node::node4Kind: return new (pool.allocate(sizeof(node4))) node4(compareIndex, representative);
+		case node::node16Kind: return new (pool.allocate(sizeof(node16))) node16(compareIndex, representative);
+		case node::node48Kind: return new (pool.allocate(sizeof(node48))) node48(compareIndex, representative);
+		case node::node256Kind: return new (pool.allocate(sizeof(node256))) node256(compareIndex, representative);
+		default: return new (pool.allocate(sparse_node::allocationSize(capacity))) sparse_node(compareIndex, representative, capacity);
+	}
+}
+
+// The smallest node kind that holds numChildren children
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::newSizedInnerNode(node_pool& pool, size_t numChildren, typename std::basic_string<charT>::size_type compareIndex, const leaf_node* representative) -> inner_node* {
+	if (numChildren <= 2) return newInnerNode(pool, node::node2Kind, 2, compareIndex, representative);
+	if (numChildren <= 4) return newInnerNode(pool, node::node4Kind, 4, compareIndex, representative);
+	if (numChildren <= 16) return newInnerNode(pool, node::node16Kind, 16, compareIndex, representative);
+	
+	if (sizeof(charT) == 1) {
+		if (numChildren <= 48) return newInnerNode(pool, node::node48Kind, 48, compareIndex, representative);
 		
+		return newInnerNode(pool, node::node256Kind, 256, compareIndex, representative);
+	}
+	
+	unsigned capacity = 32;
+	while (capacity < numChildren) capacity *= 2;
+	
+	return newInnerNode(pool, node::sparseKind, capacity, compareIndex, representative);
+}
+
+// Copies a node of another trie. An inner node's copy still refers to the other trie's children and representative.
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::cloneNode(const node& otherNode, const string_trie& otherTrie) -> node* {
+	if (otherNode.isLeaf()) {
+		const leaf_node& otherLeaf = static_cast<const leaf_node&>(otherNode);
 		
-		auto iter = node->children.find(character);
+		size_t offset = keys_.size();
 		
-		if (iter == node->children.end()) break;  // if character not found in children map
+		const charT* key = otherTrie.keyOf(otherLeaf);
+		keys_.insert(keys_.end(), key, key + otherLeaf.length);
 		
+		return new (pool_.allocate(sizeof(leaf_node))) leaf_node(offset, otherLeaf.length);
+	}
+	
+	
+	const inner_node& otherInner = static_cast<const inner_node&>(otherNode);
+	
+	unsigned capacity = otherInner.kind == node::sparseKind ? static_cast<const sparse_node&>(otherInner).capacity : 0;
+	
+	inner_node* copy = newInnerNode(otherInner.kind, capacity, otherInner.compareIndex, nullptr);
+	
+	copy->hasTerminal = otherInner.hasTerminal;
+	copy->representative = otherInner.representative;
+	copy->numLeaves = otherInner.numLeaves;
+	
+	otherInner.forEach([copy](charT character, node* child) {
+		copy->insert(character, child);
+	});
+	
+	return copy;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::destroyNode(node* node) {
+	pool_.deallocate(node, node->allocationSize());
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::addChild(inner_node* node, inner_node* parent, charT character, struct node* child) {
+	if (node->full()) {
+		node = growNode(node);
 		
-		node = iter->second;
+		replaceChild(parent, node);
 	}
 	
-	return node;
+	node->insert(character, child);
 }
 
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::growNode(inner_node* node) -> inner_node* {
+	switch (node->kind) {
+		case node::node2Kind: return resizeNode(node, node::node4Kind, 4);
+		case node::node4Kind: return resizeNode(node, node::node16Kind, 16);
+		case node::node16Kind: return sizeof(charT) == 1 ? resizeNode(node, node::node48Kind, 48) : resizeNode(node, node::sparseKind, 32);
+		case node::node48Kind: return resizeNode(node, node::node256Kind, 256);
+		default: return resizeNode(node, node::sparseKind, static_cast<sparse_node*>(node)->capacity * 2);
+	}
+}
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::searchPath(const std::basic_string<charT>& string) const -> std::vector<node*> {
-	std::vector<node*> nodes;
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::shrinkNode(inner_node* node) -> inner_node* {
+	switch (node->kind) {
+		case node::node4Kind: return resizeNode(node, node::node2Kind, 2);
+		case node::node16Kind: return resizeNode(node, node::node4Kind, 4);
+		case node::node48Kind: return resizeNode(node, node::node16Kind, 16);
+		case node::node256Kind: return resizeNode(node, node::node48Kind, 48);
+		default: {
+			unsigned capacity = static_cast<sparse_node*>(node)->capacity;
+			
+			return capacity == 32 ? resizeNode(node, node::node16Kind, 16) : resizeNode(node, node::sparseKind, capacity / 2);
+		}
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::resizeNode(inner_node* node, typename node::node_kind kind, unsigned capacity) -> inner_node* {
+	inner_node* resized = newInnerNode(kind, capacity, node->compareIndex, node->representative);
+	resized->hasTerminal = node->hasTerminal;
+	resized->numLeaves = node->numLeaves;
 	
-	node* node = root_;
+	node->forEach([resized](charT character, struct node* child) {
+		resized->insert(character, child);
+	});
 	
-	while (node) {
-		nodes.push_back(node);
-		
-		
-		if (node->isLeaf) break;  // if at a leaf node
-		
-		
-		if (node->compareIndex > string.length()) break;  // if the index we are looking at is past the end of the string
-		
-		const charT& character = string[node->compareIndex];
-		
-		
-		auto iter = node->children.find(character);
+	destroyNode(node);
+	
+	return resized;
+}
+
+// Points the edge of parent that leads towards child's strings at child (or makes child the root if there is no parent)
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::replaceChild(inner_node* parent, node* child) {
+	if (parent) {
+		assert(representativeOf(*child).length > parent->compareIndex);
 		
-		if (iter == node->children.end()) break;  // if character not found in children map
+		struct node** slot = parent->find(characterAt(*child, parent->compareIndex));
 		
+		assert(slot);
 		
-		node = iter->second;
+		*slot = child;
+	} else {
+		root_ = child;
 	}
-	
-	return nodes;
 }
 
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::leftmostDescendant(const node& root) const -> const node* {
-	const node* node = &root;
+// Moves the keys that are still in use to a fresh arena, in the order their leaves are visited
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::compactKeys() {
+	std::vector<charT> keys;
+	keys.reserve(keys_.size() - deadKeyLength_);
+	
+	// Avoid recursion as we may have very many levels
+	std::stack<node*> nodes;
+	
+	if (root_) nodes.push(root_);
 	
-	while (!node->isLeaf) {
-		node = node->children.begin()->second;
+	while (!nodes.empty()) {
+		node* node = nodes.top();
+		nodes.pop();
+		
+		if (node->isLeaf()) {
+			leaf_node* leaf = static_cast<leaf_node*>(node);
+			
+			const charT* key = keyOf(*leaf);
+			
+			leaf->offset = keys.size();
+			keys.insert(keys.end(), key, key + leaf->length);
+		} else {
+			inner_node* inner = static_cast<inner_node*>(node);
+			
+			inner->forEach([&nodes](charT, struct node* child) {
+				nodes.push(child);
+			});
+			
+			if (inner->hasTerminal) nodes.push(inner->terminal());
+		}
 	}
 	
-	return node;
+	keys_.swap(keys);
+	deadKeyLength_ = 0;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+const charT* string_trie<charT, reservedChar, binaryKeys>::keyOf(const leaf_node& leaf) const {
+	return keys_.data() + leaf.offset;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::representativeOf(const node& node) -> const leaf_node& {
+	return node.isLeaf() ? static_cast<const leaf_node&>(node) : *static_cast<const inner_node&>(node).representative;
 }
 
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::rightmostDescendant(const node& root) const -> const node* {
-	const node* node = &root;
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::numLeavesOf(const node& node) {
+	return node.isLeaf() ? 1 : static_cast<const inner_node&>(node).numLeaves;
+}
+
+// Returns the number of leaves of inner that come before the branch string goes down (or would go down, if inner has
+// no such child). string must not end before inner's compare index.
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::numLeavesBefore(const inner_node& inner, std::basic_string_view<charT> string) {
+	assert(string.length() >= inner.compareIndex);
 	
-	while (!node->isLeaf) {
-		node = node->children.rbegin()->second;
-	}
+	if (string.length() == inner.compareIndex) return 0;  // the terminal leaf comes first
 	
-	return node;
+	
+	return inner.hasTerminal + inner.numLeavesBefore(string[inner.compareIndex]);
 }
 
-
-template<typename charT, charT reservedChar>
-auto string_trie<charT, reservedChar>::siblingOfNewInternalNode(typename std::basic_string<charT>::size_type compareIndex, const std::vector<struct node*>& nodesInSearchPath, node** parentRef) const -> node* {
-	node* parent = nullptr;
-	node* node = nullptr;
+// Returns the child of inner that string continues into (the terminal leaf if string ends at inner's compare index),
+// or nullptr if string ends before inner's compare index or has no child there
+template<typename charT, charT reservedChar, bool binaryKeys>
+auto string_trie<charT, reservedChar, binaryKeys>::childTowards(const inner_node& inner, std::basic_string_view<charT> string) -> node* {
+	STRING_TRIE_COUNT(nodesVisited, 1);
 	
-	for (typename std::vector<struct node*>::const_reverse_iterator i = nodesInSearchPath.rbegin(); i != nodesInSearchPath.rend(); i++) {
-		node = *i;
-		parent = (i == nodesInSearchPath.rend() - 1) ? nullptr : *(i + 1);
-		
-		assert(!parent || parent->compareIndex != compareIndex);
-		
-		if (parent && parent->compareIndex < compareIndex) break;
-	}
+	if (inner.compareIndex == string.length()) return inner.terminal();
+	if (inner.compareIndex > string.length()) return nullptr;
 	
-	if (parentRef) *parentRef = parent;
-	return node;
+	node* const* child = inner.find(string[inner.compareIndex]);
+	
+	return child ? *child : nullptr;
+}
+
+// Only meaningful for indices before an inner node's compare index
+template<typename charT, charT reservedChar, bool binaryKeys>
+charT string_trie<charT, reservedChar, binaryKeys>::characterAt(const node& node, typename std::basic_string<charT>::size_type index) const {
+	return keyOf(representativeOf(node))[index];
 }
 
+// The string a node stands for: a leaf's key, or the path to an inner node
+template<typename charT, charT reservedChar, bool binaryKeys>
+std::basic_string<charT> string_trie<charT, reservedChar, binaryKeys>::stringOf(const node& node) const {
+	const leaf_node& leaf = representativeOf(node);
+	
+	return std::basic_string<charT>(keyOf(leaf), node.isLeaf() ? leaf.length : static_cast<const inner_node&>(node).compareIndex);
+}
 
-template<typename charT, charT reservedChar>
-typename std::basic_string<charT>::size_type string_trie<charT, reservedChar>::indexOfFirstDifference(const std::basic_string<charT>& string1, const std::basic_string<charT>& string2) {
-	typename std::basic_string<charT>::size_type length1 = string1.length();
-	typename std::basic_string<charT>::size_type length2 = string2.length();
+// Returns npos if string is a leaf's key, and otherwise the index at which string leaves the path to node
+template<typename charT, charT reservedChar, bool binaryKeys>
+typename std::basic_string<charT>::size_type string_trie<charT, reservedChar, binaryKeys>::indexOfFirstDifference(std::basic_string_view<charT> string, const node& node) const {
+	const leaf_node& leaf = representativeOf(node);
+	
+	const charT* key = keyOf(leaf);
+	
+	typename std::basic_string<charT>::size_type length1 = string.length();
+	typename std::basic_string<charT>::size_type length2 = node.isLeaf() ? leaf.length : static_cast<const inner_node&>(node).compareIndex;
+	
+	typename std::basic_string<charT>::size_type length = std::min(length1, length2);
 	
-	for (typename std::basic_string<charT>::size_type i = 0; i < length1 && i < length2; i++) {
-		if (string1[i] != string2[i]) return i;  // if characters do not match, return index
+	for (typename std::basic_string<charT>::size_type i = 0; i < length; i++) {
+		if (string[i] != key[i]) return i;  // if characters do not match, return index
 	}
 	
-	return std::basic_string<charT>::npos;  // all characters matched (assumes every string is terminated by reservedChar)
+	if (node.isLeaf() && length1 == length2) return std::basic_string<charT>::npos;  // all characters matched
+	
+	// Otherwise one of them ends first (for an inner node, string may continue at the node's compare index)
+	return length;
 }
 
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::normalizeString(std::basic_string<charT>& string) {
-	if (string.length() == 0) throw std::invalid_argument("String must not be empty.");  // string cannot be empty
-	if (string.find_first_of(reservedChar) != std::basic_string<charT>::npos) throw std::invalid_argument("String must not contain specified reserved character.");  // string cannot contain reserved character
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::validateString(std::basic_string_view<charT> string) {
+	if (binaryKeys) return;  // any string is a valid key
 	
-	string.append(1, reservedChar);  // append our end-of-string character
+	if (string.length() == 0) throw std::invalid_argument("String must not be empty.");  // string cannot be empty
+	if (string.find_first_of(reservedChar) != std::basic_string_view<charT>::npos) throw std::invalid_argument("String must not contain specified reserved character.");  // string cannot contain reserved character
+}
+
+// Only strings that are stored need to fit in a leaf
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::validateLength(std::basic_string_view<charT> string) {
+	if (string.length() > maximumKeyLength()) throw std::length_error("String is too long.");
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::maximumKeyLength() {
+#ifdef DEBUG
+	return debugMaximumKeyLength();
+#else
+	return leafLengthLimit;
+#endif
 }
 
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::swap(string_trie<charT, reservedChar>& trie1, string_trie<charT, reservedChar>& trie2) {
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::prefetch(const void* address) {
+#if defined(__GNUC__)
+	__builtin_prefetch(address);
+#else
+	(void)address;
+#endif
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::swap(string_trie<charT, reservedChar, binaryKeys>& trie1, string_trie<charT, reservedChar, binaryKeys>& trie2) {
 	using std::swap;
 	
 	swap(trie1.root_, trie2.root_);
 	swap(trie1.size_, trie2.size_);
+	
+	node_pool::swap(trie1.pool_, trie2.pool_);
+	
+	swap(trie1.keys_, trie2.keys_);
+	swap(trie1.deadKeyLength_, trie2.deadKeyLength_);
+}
+
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+string_trie_statistics string_trie<charT, reservedChar, binaryKeys>::statistics() const {
+	string_trie_statistics statistics = string_trie_statistics();
+	
+	statistics.poolBytes = pool_.memoryUsage();
+	statistics.keyBytes = keys_.capacity() * sizeof(charT);
+	
+	
+	// Avoid recursion as we may have very many levels
+	std::stack<std::pair<const node*, size_t>> nodes;
+	
+	if (root_) nodes.push(std::make_pair(root_, 0));
+	
+	while (!nodes.empty()) {
+		const node* node = nodes.top().first;
+		size_t depth = nodes.top().second;
+		nodes.pop();
+		
+		statistics.nodeBytes += node->allocationSize();
+		
+		if (node->isLeaf()) {
+			statistics.numLeaves++;
+			
+			if (statistics.depthHistogram.size() <= depth) statistics.depthHistogram.resize(depth + 1, 0);
+			
+			statistics.depthHistogram[depth]++;
+		} else {
+			const inner_node* inner = static_cast<const inner_node*>(node);
+			
+			statistics.numInnerNodes++;
+			statistics.numInnerNodesOfKind[inner->kind - node::node2Kind]++;
+			
+			if (inner->hasTerminal) {
+				statistics.numTerminals++;
+				
+				nodes.push(std::make_pair(inner->terminal(), depth + 1));
+			}
+			
+			inner->forEach([&nodes, depth](charT, struct node* child) {
+				nodes.push(std::make_pair(child, depth + 1));
+			});
+		}
+	}
+	
+	return statistics;
 }
 
+#endif
+
 
 #ifdef DEBUG
 
@@ -679,8 +2801,6 @@ void string_trie<charT, reservedChar>::swap(string_trie<charT, reservedChar>& tr
 
 template<typename charT>
 std::ostream& operator<<(std::ostream& out, std::basic_string<charT> string) {
-	string.pop_back();
-	
 	for (const auto& character : string) {
 		out << (char)character;
 	}
@@ -688,8 +2808,26 @@ std::ostream& operator<<(std::ostream& out, std::basic_string<charT> string) {
 	return out;
 }
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::printStructure() const {
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t string_trie<charT, reservedChar, binaryKeys>::setMaximumKeyLength(size_t length) {
+	assert(length <= leafLengthLimit);
+	
+	size_t previous = debugMaximumKeyLength();
+	debugMaximumKeyLength() = length;
+	
+	return previous;
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+size_t& string_trie<charT, reservedChar, binaryKeys>::debugMaximumKeyLength() {
+	static size_t length = leafLengthLimit;
+	
+	return length;
+}
+
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::printStructure() const {
 	std::cerr << "begin structure" << std::endl;
 	
 	if (root_) printNode(*root_);
@@ -697,77 +2835,175 @@ void string_trie<charT, reservedChar>::printStructure() const {
 	std::cerr << "end structure" << std::endl << std::endl;
 }
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::printNode(const node& node) const {
-	if (node.isLeaf) {
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::printNode(const node& node) const {
+	if (node.isLeaf()) {
 		std::cerr << "Leaf Node" << std::endl << "---------" << std::endl;
-		std::cerr << "String: " << node.string << std::endl << std::endl;
+		std::cerr << "String: " << stringOf(node) << std::endl << std::endl;
 	} else {
+		const inner_node& inner = static_cast<const inner_node&>(node);
+		
 		std::cerr << "Internal Node" << std::endl << "-------------" << std::endl;
-		std::cerr << "Compare index: " << node.compareIndex << std::endl;
-		std::cerr << "Path: " << node.string << std::endl;
+		std::cerr << "Compare index: " << inner.compareIndex << std::endl;
+		std::cerr << "Path: " << stringOf(inner) << std::endl;
 		std::cerr << "Children:";
 		
-		for (const auto& element : node.children) {
+		if (inner.hasTerminal) std::cerr << " (" << stringOf(*inner.terminal()) << ")";
+		
+		inner.forEach([this](charT, struct node* child) {
 			std::cerr << " (";
 			
-			struct node* child = element.second;
-			if (child->isLeaf) {
-				std::cerr << child->string;
+			if (child->isLeaf()) {
+				std::cerr << stringOf(*child);
 			} else {
-				std::cerr << child->compareIndex;
+				std::cerr << static_cast<const inner_node*>(child)->compareIndex;
 			}
 			
 			std::cerr << ")";
-		}
+		});
 		
 		std::cerr << std::endl << std::endl;
 		
 		
-		for (const auto& element : node.children) {
-			printNode(*element.second);
-		}
+		inner.forEach([this](charT, struct node* child) {
+			printNode(*child);
+		});
 	}
 }
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::verifyStructure() const {
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::verifyStructure() const {
+	size_t numLeaves = 0;
+	size_t keyLength = 0;
+	
 	if (root_) {
-		assert(root_->string.length() > 0);
-		
-		if (root_->isLeaf) {
-			assert(root_->children.size() == 0);
+		if (root_->isLeaf()) {
+			numLeaves++;
+			keyLength += static_cast<const leaf_node*>(root_)->length;
 		} else {
-			assert(root_->string.length() == root_->compareIndex + 1);
-			assert(root_->children.size() > 1);
+			const inner_node& root = static_cast<const inner_node&>(*root_);
 			
-			auto newPath = root_->string.substr(0, root_->string.length() - 1);
+			assert(root.numBranches() > 1);
 			
-			for (const auto& element : root_->children) {
-				verifyNode(*element.second, root_->compareIndex, newPath);
-			}
+			verifyChildren(root, numLeaves, keyLength);
 		}
 	}
+	
+	assert(numLeaves == size_);
+	assert(keyLength + deadKeyLength_ == keys_.size());
 }
 
-template<typename charT, charT reservedChar>
-void string_trie<charT, reservedChar>::verifyNode(const node& node, typename std::basic_string<charT>::size_type compareIndex, const std::basic_string<charT>& path) const {
-	assert(node.string.length() > compareIndex);
-	assert(node.string.rfind(path, compareIndex) != std::basic_string<charT>::npos);
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::verifyNode(const node& node, typename std::basic_string<charT>::size_type compareIndex, const std::basic_string<charT>& path, size_t& numLeaves, size_t& keyLength) const {
+	std::basic_string<charT> string = stringOf(node);
 	
-	if (node.isLeaf) {
-		assert(node.children.size() == 0);
+	assert(string.length() > compareIndex);
+	assert(string.rfind(path, compareIndex) != std::basic_string<charT>::npos);
+	
+	if (node.isLeaf()) {
+		const leaf_node& leaf = static_cast<const leaf_node&>(node);
+		
+		assert(binaryKeys || std::find(keyOf(leaf), keyOf(leaf) + leaf.length, reservedChar) == keyOf(leaf) + leaf.length);
+		
+		numLeaves++;
+		keyLength += leaf.length;
 	} else {
-		assert(node.compareIndex > compareIndex);
-		assert(node.string.length() == node.compareIndex + 1);
-		assert(node.children.size() > 1);
+		const inner_node& inner = static_cast<const inner_node&>(node);
 		
-		auto newPath = node.string.substr(0, node.string.length() - 1);
+		assert(inner.compareIndex > compareIndex);
+		assert(inner.numBranches() > 1);
 		
-		for (const auto& element : node.children) {
-			verifyNode(*element.second, node.compareIndex, newPath);
-		}
+		verifyChildren(inner, numLeaves, keyLength);
+	}
+}
+
+template<typename charT, charT reservedChar, bool binaryKeys>
+void string_trie<charT, reservedChar, binaryKeys>::verifyChildren(const inner_node& node, size_t& numLeaves, size_t& keyLength) const {
+	switch (node.kind) {
+		case node::node2Kind: assert(node.numChildren <= 2); break;
+		case node::node4Kind: assert(node.numChildren <= 4); break;
+		case node::node16Kind: assert(node.numChildren <= 16); break;
+		case node::node48Kind: assert(sizeof(charT) == 1 && node.numChildren <= 48); break;
+		case node::node256Kind: assert(sizeof(charT) == 1 && node.numChildren <= 256); break;
+		default: assert(sizeof(charT) > 1 && node.numChildren <= static_cast<const sparse_node&>(node).capacity); break;
+	}
+	
+	
+	auto newPath = std::basic_string<charT>(keyOf(*node.representative), node.compareIndex);
+	
+	size_t numEarlierLeaves = numLeaves;  // counted before node
+	unsigned numChildren = 0;
+	const struct node* previousChild = nullptr;
+	bool representativeFound = false;
+	
+	if (node.hasTerminal) {
+		const leaf_node& terminal = *node.representative;
+		
+		assert(terminal.length == node.compareIndex);
+		assert(std::equal(newPath.begin(), newPath.end(), keyOf(terminal)));
+		assert(binaryKeys || std::find(keyOf(terminal), keyOf(terminal) + terminal.length, reservedChar) == keyOf(terminal) + terminal.length);
+		
+		numLeaves++;
+		keyLength += terminal.length;
+		
+		representativeFound = true;
 	}
+	
+	node.forEach([&](charT character, struct node* child) {
+		assert(characterAt(*child, node.compareIndex) == character);
+		assert(node.find(character) && *node.find(character) == child);
+		assert(!previousChild || inner_node::less(characterAt(*previousChild, node.compareIndex), character));
+		assert(node.previous(character) == previousChild);
+		assert(!previousChild || node.next(characterAt(*previousChild, node.compareIndex)) == child);
+		
+		size_t childNumLeaves = numLeaves;
+		
+		verifyNode(*child, node.compareIndex, newPath, numLeaves, keyLength);
+		
+		// Checks the leaf counts of node48 and node256 along with the others
+		size_t index = childNumLeaves - numEarlierLeaves - node.hasTerminal;
+		charT childCharacter = charT();
+		
+		assert(node.numLeavesBefore(character) == index);
+		assert(node.childHolding(index, childCharacter) == child && index == 0 && childCharacter == character);
+		
+		// The representative must be one of the leaves below node
+		if (child->isLeaf()) {
+			representativeFound = representativeFound || child == node.representative;
+		} else if (!representativeFound) {
+			const leaf_node* representative = node.representative;
+			
+			std::stack<const struct node*> descendants;
+			descendants.push(child);
+			
+			while (!descendants.empty() && !representativeFound) {
+				const struct node* descendant = descendants.top();
+				descendants.pop();
+				
+				if (descendant->isLeaf()) {
+					representativeFound = descendant == representative;
+				} else {
+					const inner_node* inner = static_cast<const inner_node*>(descendant);
+					
+					inner->forEach([&descendants](charT, struct node* grandchild) {
+						descendants.push(grandchild);
+					});
+					
+					if (inner->hasTerminal) descendants.push(inner->terminal());
+				}
+			}
+		}
+		
+		assert(numLeaves > childNumLeaves);
+		
+		numChildren++;
+		previousChild = child;
+	});
+	
+	assert(representativeFound);
+	assert(numChildren == node.numChildren);
+	assert(numLeaves - numEarlierLeaves == node.numLeaves);
+	assert(node.last() == previousChild);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1067 @@
+// string_trie: A C++ Patricia trie implementation for strings.
+// Copyright (C) 2013 Darren Mo
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+// Times string_trie, its frozen and concurrent forms, std::set and std::unordered_set on the same keys and queries.
+// Every structure has to give the same answers, so a run doubles as a check. Then times concurrent_string_trie's
+// readers while a writer runs.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "string_trie.hpp"
+#include "concurrent_string_trie.hpp"
+#include "frozen_string_trie.hpp"
+
+
+/* Memory accounting */
+
+static size_t allocatedBytes = 0;
+
+// Counts what the standard containers allocate for their nodes and buckets
+template<typename T>
+struct counting_allocator {
+	typedef T value_type;
+	
+	
+	counting_allocator() {}
+	template<typename U> counting_allocator(const counting_allocator<U>&) {}
+	
+	T* allocate(size_t count) {
+		allocatedBytes += count * sizeof(T);
+		
+		return std::allocator<T>().allocate(count);
+	}
+	
+	void deallocate(T* pointer, size_t count) {
+		allocatedBytes -= count * sizeof(T);
+		
+		std::allocator<T>().deallocate(pointer, count);
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const counting_allocator<T>&, const counting_allocator<U>&) {
+	return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const counting_allocator<T>&, const counting_allocator<U>&) {
+	return false;
+}
+
+
+/* Structures under test */
+
+typedef string_trie<char, '\n'> trie_type;
+typedef frozen_string_trie<char, '\n'> frozen_type;
+typedef concurrent_string_trie<char, '\n'> concurrent_trie_type;
+typedef concurrent_trie_type::snapshot snapshot_type;
+typedef std::set<std::string, std::less<std::string>, counting_allocator<std::string>> set_type;
+typedef std::unordered_set<std::string, std::hash<std::string>, std::equal_to<std::string>, counting_allocator<std::string>> unordered_set_type;
+
+// counted structures can count the keys with a prefix and select by position without walking them
+template<typename structure> struct structure_traits {
+	static constexpr bool ordered = true;
+	static constexpr bool batched = false;
+	static constexpr bool counted = false;
+};
+
+template<> struct structure_traits<trie_type> {
+	static constexpr bool ordered = true;
+	static constexpr bool batched = true;
+	static constexpr bool counted = true;
+};
+
+template<> struct structure_traits<set_type> {
+	static constexpr bool ordered = true;
+	static constexpr bool batched = false;
+	static constexpr bool counted = true;  // by walking, to compare against
+};
+
+template<> struct structure_traits<unordered_set_type> {
+	static constexpr bool ordered = false;
+	static constexpr bool batched = false;
+	static constexpr bool counted = false;
+};
+
+
+static bool containsKey(const trie_type& trie, const std::string& key) {
+	return trie.contains(key);
+}
+
+static bool containsKey(const frozen_type& trie, const std::string& key) {
+	return trie.contains(key);
+}
+
+static bool containsKey(const snapshot_type& snapshot, const std::string& key) {
+	return snapshot.contains(key);
+}
+
+template<typename setType>
+static bool containsKey(const setType& set, const std::string& key) {
+	return set.find(key) != set.end();
+}
+
+static void removeKey(trie_type& trie, const std::string& key) {
+	trie.remove(key);
+}
+
+static void removeKey(concurrent_trie_type& trie, const std::string& key) {
+	trie.remove(key);
+}
+
+template<typename setType>
+static void removeKey(setType& set, const std::string& key) {
+	set.erase(key);
+}
+
+// Returns one more than the length of the first key after key, or 0 if there is none
+static size_t successorOf(const trie_type& trie, const std::string& key) {
+	auto successor = trie.successor(key);
+	
+	return successor == trie.cend() ? 0 : (*successor).length() + 1;
+}
+
+static size_t successorOf(const frozen_type& trie, const std::string& key) {
+	auto successor = trie.successor(key);
+	
+	return successor == trie.cend() ? 0 : (*successor).length() + 1;
+}
+
+static size_t successorOf(const snapshot_type& snapshot, const std::string& key) {
+	auto successor = snapshot.successor(key);
+	
+	return successor == snapshot.cend() ? 0 : (*successor).length() + 1;
+}
+
+static size_t successorOf(const set_type& set, const std::string& key) {
+	auto successor = set.upper_bound(key);
+	
+	return successor == set.end() ? 0 : successor->length() + 1;
+}
+
+// Steps through the keys with prefix and returns how many there are
+static size_t walkPrefixed(const trie_type& trie, const std::string& prefix) {
+	auto range = trie.prefixedStrings(prefix);
+	
+	return static_cast<size_t>(std::distance(range.begin(), range.end()));
+}
+
+static size_t walkPrefixed(const frozen_type& trie, const std::string& prefix) {
+	auto range = trie.prefixedStrings(prefix);
+	
+	return static_cast<size_t>(std::distance(range.begin(), range.end()));
+}
+
+static size_t walkPrefixed(const snapshot_type& snapshot, const std::string& prefix) {
+	auto range = snapshot.prefixedStrings(prefix);
+	
+	return static_cast<size_t>(std::distance(range.begin(), range.end()));
+}
+
+static size_t walkPrefixed(const set_type& set, const std::string& prefix) {
+	size_t count = 0;
+	
+	for (auto i = set.lower_bound(prefix); i != set.end() && i->compare(0, prefix.length(), prefix) == 0; ++i) {
+		count++;
+	}
+	
+	return count;
+}
+
+static size_t countPrefixed(const trie_type& trie, const std::string& prefix) {
+	return trie.countPrefixed(prefix);
+}
+
+static size_t countPrefixed(const set_type& set, const std::string& prefix) {
+	return walkPrefixed(set, prefix);
+}
+
+// Returns one more than the length of the key halfway through the keys with prefix, as paging far into them would
+// reach, or 0 if there is none
+static size_t middlePrefixed(const trie_type& trie, const std::string& prefix) {
+	size_t count = trie.countPrefixed(prefix);
+	
+	return count == 0 ? 0 : (*trie.select(trie.rank(prefix) + count / 2)).length() + 1;
+}
+
+static size_t middlePrefixed(const set_type& set, const std::string& prefix) {
+	size_t count = walkPrefixed(set, prefix);
+	
+	return count == 0 ? 0 : std::next(set.lower_bound(prefix), count / 2)->length() + 1;
+}
+
+// containerBytes is what the structure's allocator handed out while it was built
+static size_t memoryOf(const trie_type& trie, size_t) {
+	return trie.memoryUsage();
+}
+
+template<typename setType>
+static size_t memoryOf(const setType& set, size_t containerBytes) {
+	static const size_t inlineCapacity = std::string().capacity();
+	
+	size_t bytes = sizeof(set) + containerBytes;
+	
+	// Long keys live on the heap, outside the container
+	for (const auto& key : set) {
+		if (key.capacity() > inlineCapacity) bytes += key.capacity() + 1;
+	}
+	
+	return bytes;
+}
+
+
+/* Key sets */
+
+struct dataset {
+	std::string name;
+	
+	std::vector<std::string> keys;  // distinct, in the order they are inserted
+	std::vector<std::string> sortedKeys;
+	std::vector<std::string> hits;  // the keys again, in another order
+	std::vector<std::string> misses;  // close to keys but none of them one
+	std::vector<std::string> prefixes;
+};
+
+struct options {
+	bool quick = false;
+	size_t numKeys = 0;  // 0 for every word and 200000 generated keys
+	unsigned numRuns = 3;
+	unsigned maxReaders = 0;  // 0 for one per hardware thread
+	std::string wordList = STRING_TRIE_WORD_LIST;
+	std::vector<std::string> datasets;
+};
+
+// Shuffles keys, drops duplicates and keeps at most count of them, then derives the queries
+static dataset makeDataset(const std::string& name, std::vector<std::string> keys, size_t count, size_t numPrefixes, std::mt19937_64& random) {
+	dataset data;
+	data.name = name;
+	
+	std::shuffle(keys.begin(), keys.end(), random);
+	
+	std::unordered_set<std::string> distinct;
+	
+	for (auto& key : keys) {
+		if (data.keys.size() == count) break;
+		
+		if (!key.empty() && distinct.insert(key).second) data.keys.push_back(std::move(key));
+	}
+	
+	data.sortedKeys = data.keys;
+	std::sort(data.sortedKeys.begin(), data.sortedKeys.end());
+	
+	data.hits = data.keys;
+	std::shuffle(data.hits.begin(), data.hits.end(), random);
+	
+	
+	// Misses change, cut or extend a key, so they share most of its path
+	for (size_t i = 0; i < data.hits.size(); i++) {
+		std::string miss = data.hits[i];
+		
+		switch (i % 3) {
+			case 0: miss.back() = miss.back() == '#' ? '$' : '#'; break;
+			case 1: miss.pop_back(); break;
+			default: miss.append("~x"); break;
+		}
+		
+		if (!miss.empty() && !distinct.count(miss)) data.misses.push_back(miss);
+	}
+	
+	for (size_t i = 0; i < numPrefixes && i < data.hits.size(); i++) {
+		const std::string& key = data.hits[i];
+		
+		data.prefixes.push_back(key.substr(0, std::max<size_t>(1, key.length() / 2)));
+	}
+	
+	return data;
+}
+
+static std::vector<std::string> loadWords(const std::string& path) {
+	std::ifstream file(path);
+	
+	std::vector<std::string> words;
+	std::string word;
+	
+	while (std::getline(file, word)) {
+		if (!word.empty() && word.back() == '\r') word.pop_back();
+		
+		words.push_back(word);
+	}
+	
+	return words;
+}
+
+// Letters follow a Zipf distribution, so a few paths are very crowded and long shared prefixes are common
+static std::vector<std::string> skewedKeys(size_t count, std::mt19937_64& random) {
+	std::vector<double> weights;
+	
+	for (int i = 0; i < 26; i++) {
+		weights.push_back(1 / std::pow(i + 1, 1.5));
+	}
+	
+	std::discrete_distribution<int> letter(weights.begin(), weights.end());
+	std::uniform_int_distribution<size_t> length(4, 24);
+	
+	std::vector<std::string> keys;
+	
+	for (size_t i = 0; i < count * 2; i++) {
+		std::string key(length(random), ' ');
+		
+		for (auto& character : key) {
+			character = static_cast<char>('a' + letter(random));
+		}
+		
+		keys.push_back(key);
+	}
+	
+	return keys;
+}
+
+// Every key shares one of a few long prefixes and then differs only in a handful of characters
+static std::vector<std::string> urlKeys(size_t count, std::mt19937_64& random) {
+	static const char* const hosts[] = {"https://www.example.com", "https://cdn.example.com", "https://api.example.org", "https://static.assets.example.net"};
+	static const char* const paths[] = {"/api/v2/users/", "/assets/images/products/thumbnails/", "/blog/posts/2013/07/", "/docs/reference/containers/string_trie/"};
+	
+	std::vector<std::string> keys;
+	
+	for (size_t i = 0; i < count * 2; i++) {
+		std::string key = hosts[random() % 4];
+		
+		key += paths[random() % 4];
+		key += std::to_string(random() % 50000);
+		key += "/items/";
+		key += std::to_string(random() % 1000);
+		key += "?page=";
+		key += std::to_string(random() % 10);
+		
+		keys.push_back(key);
+	}
+	
+	return keys;
+}
+
+
+/* Timing */
+
+static const size_t numMoves = 1000;  // there and back again, per run
+
+enum operation {
+	insertOperation,
+	bulkLoadOperation,
+	containsHitOperation,
+	containsMissOperation,
+	containsBatchOperation,
+	successorOperation,
+	iterateOperation,
+	reverseIterateOperation,
+	prefixedOperation,
+	countPrefixedOperation,
+	middlePrefixedOperation,
+	copyOperation,
+	moveOperation,
+	removeOperation,
+	numOperations
+};
+
+static const char* const operationNames[numOperations] = {
+	"insert",
+	"bulk load (sorted)",
+	"contains (hits)",
+	"contains (misses)",
+	"contains (batch)",
+	"successor",
+	"iterate",
+	"reverse iterate",
+	"prefixedStrings",
+	"countPrefixed",
+	"select (mid-prefix)",
+	"copy",
+	"move",
+	"remove"
+};
+
+struct measurement {
+	bool measured = false;
+	double nanoseconds = 0;  // per operation, fastest run
+	size_t answer = 0;  // checked against the other structures
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+	string_trie_counters counters = string_trie_counters();  // of the last run
+#endif
+};
+
+struct results {
+	const char* name;
+	measurement measurements[numOperations];
+	size_t bytes = 0;  // 0 if not known
+};
+
+// Calls setup() then body() numRuns times and records the fastest body() per operation. body() returns its answer.
+template<typename setupFunction, typename bodyFunction>
+static void measure(measurement& result, unsigned numRuns, size_t numOperations, setupFunction setup, bodyFunction body) {
+	result.measured = true;
+	result.nanoseconds = INFINITY;
+	
+	for (unsigned run = 0; run < numRuns; run++) {
+		setup();
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+		string_trie_counters::thisThread() = string_trie_counters();
+#endif
+		
+		auto start = std::chrono::steady_clock::now();
+		
+		result.answer = body();
+		
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+		result.counters = string_trie_counters::thisThread();
+#endif
+		
+		result.nanoseconds = std::min(result.nanoseconds, elapsed.count() / std::max<size_t>(numOperations, 1));
+	}
+}
+
+// Times the lookups and walks, which leave keys as they are
+template<typename structure>
+static void benchmarkQueries(measurement* measurements, const structure& keys, const dataset& data, unsigned numRuns) {
+	auto nothing = []() {};
+	
+	
+	measure(measurements[containsHitOperation], numRuns, data.hits.size(), nothing, [&]() {
+		size_t found = 0;
+		
+		for (const auto& key : data.hits) {
+			found += containsKey(keys, key);
+		}
+		
+		return found;
+	});
+	
+	measure(measurements[containsMissOperation], numRuns, data.misses.size(), nothing, [&]() {
+		size_t found = 0;
+		
+		for (const auto& key : data.misses) {
+			found += containsKey(keys, key);
+		}
+		
+		return found;
+	});
+	
+	if constexpr (structure_traits<structure>::batched) {
+		std::vector<std::string_view> views(data.hits.begin(), data.hits.end());
+		std::unique_ptr<bool[]> found(new bool[views.size()]);
+		
+		measure(measurements[containsBatchOperation], numRuns, views.size(), nothing, [&]() {
+			keys.containsBatch(views.data(), views.size(), found.get());
+			
+			return static_cast<size_t>(std::count(found.get(), found.get() + views.size(), true));
+		});
+	}
+	
+	if constexpr (structure_traits<structure>::ordered) {
+		measure(measurements[successorOperation], numRuns, data.misses.size(), nothing, [&]() {
+			size_t total = 0;
+			
+			for (const auto& key : data.misses) {
+				total += successorOf(keys, key);
+			}
+			
+			return total;
+		});
+	}
+	
+	measure(measurements[iterateOperation], numRuns, data.keys.size(), nothing, [&]() {
+		size_t total = 0;
+		
+		for (auto i = keys.cbegin(); i != keys.cend(); ++i) {
+			total += (*i).length();
+		}
+		
+		return total;
+	});
+	
+	if constexpr (structure_traits<structure>::ordered) {
+		measure(measurements[reverseIterateOperation], numRuns, data.keys.size(), nothing, [&]() {
+			size_t total = 0;
+			
+			for (auto i = keys.crbegin(); i != keys.crend(); ++i) {
+				total += (*i).length();
+			}
+			
+			return total;
+		});
+	}
+	
+	if constexpr (structure_traits<structure>::ordered) {
+		measure(measurements[prefixedOperation], numRuns, data.prefixes.size(), nothing, [&]() {
+			size_t total = 0;
+			
+			for (const auto& prefix : data.prefixes) {
+				total += walkPrefixed(keys, prefix);
+			}
+			
+			return total;
+		});
+	}
+	
+	if constexpr (structure_traits<structure>::counted) {
+		measure(measurements[countPrefixedOperation], numRuns, data.prefixes.size(), nothing, [&]() {
+			size_t total = 0;
+			
+			for (const auto& prefix : data.prefixes) {
+				total += countPrefixed(keys, prefix);
+			}
+			
+			return total;
+		});
+		
+		measure(measurements[middlePrefixedOperation], numRuns, data.prefixes.size(), nothing, [&]() {
+			size_t total = 0;
+			
+			for (const auto& prefix : data.prefixes) {
+				total += middlePrefixed(keys, prefix);
+			}
+			
+			return total;
+		});
+	}
+}
+
+template<typename structure>
+static results benchmark(const char* name, const dataset& data, const options& options) {
+	results results;
+	results.name = name;
+	
+	measurement* measurements = results.measurements;
+	unsigned numRuns = options.numRuns;
+	
+	auto nothing = []() {};
+	
+	
+	structure keys;
+	
+	measure(measurements[insertOperation], numRuns, data.keys.size(), [&]() { keys.clear(); }, [&]() {
+		for (const auto& key : data.keys) {
+			keys.insert(key);
+		}
+		
+		return keys.size();
+	});
+	
+	{
+		std::unique_ptr<structure> loaded;
+		
+		measure(measurements[bulkLoadOperation], numRuns, data.keys.size(), [&]() { loaded.reset(); }, [&]() {
+			loaded.reset(new structure(data.sortedKeys.begin(), data.sortedKeys.end()));
+			
+			return loaded->size();
+		});
+	}
+	
+	{
+		keys.clear();
+		
+		size_t before = allocatedBytes;
+		
+		for (const auto& key : data.keys) {
+			keys.insert(key);
+		}
+		
+		results.bytes = memoryOf(keys, allocatedBytes - before);
+	}
+	
+	
+	benchmarkQueries(measurements, keys, data, numRuns);
+	
+	{
+		std::unique_ptr<structure> copy;
+		
+		measure(measurements[copyOperation], numRuns, keys.size(), [&]() { copy.reset(); }, [&]() {
+			copy.reset(new structure(keys));
+			
+			return copy->size();
+		});
+	}
+	
+	{
+		measure(measurements[moveOperation], numRuns, numMoves * 2, nothing, [&]() {
+			for (size_t i = 0; i < numMoves; i++) {
+				structure moved(std::move(keys));
+				
+				keys = std::move(moved);
+			}
+			
+			return keys.size();
+		});
+	}
+	
+	measure(measurements[removeOperation], numRuns, data.hits.size(), [&]() {
+		for (const auto& key : data.keys) {
+			keys.insert(key);
+		}
+	}, [&]() {
+		for (const auto& key : data.hits) {
+			removeKey(keys, key);
+		}
+		
+		return keys.size();
+	});
+	
+	return results;
+}
+
+
+// The trie bulk loaded, frozen, saved and mapped back from the file, as a program that ships a frozen trie uses it
+static results benchmarkFrozen(const char* name, const dataset& data, const options& options) {
+	results results;
+	results.name = name;
+	
+	std::string path = (std::filesystem::temp_directory_path() / "string_trieBenchmarks.frozen").string();
+	
+	trie_type(data.sortedKeys.begin(), data.sortedKeys.end()).freeze().save(path);
+	
+	frozen_type keys = frozen_type::open(path);
+	
+	std::remove(path.c_str());  // the mapping keeps the pages
+	
+	benchmarkQueries(results.measurements, keys, data, options.numRuns);
+	
+	results.bytes = keys.memoryUsage();
+	
+	return results;
+}
+
+// Writers go through the trie and readers through one snapshot, taken once the keys are in
+static results benchmarkConcurrent(const char* name, const dataset& data, const options& options) {
+	results results;
+	results.name = name;
+	
+	measurement* measurements = results.measurements;
+	unsigned numRuns = options.numRuns;
+	
+	
+	concurrent_trie_type keys;
+	
+	measure(measurements[insertOperation], numRuns, data.keys.size(), [&]() { keys.clear(); }, [&]() {
+		for (const auto& key : data.keys) {
+			keys.insert(key);
+		}
+		
+		return keys.size();
+	});
+	
+	{
+		snapshot_type snapshot = keys.read();
+		
+		benchmarkQueries(measurements, snapshot, data, numRuns);
+	}
+	
+	{
+		std::unique_ptr<concurrent_trie_type> copy;
+		
+		measure(measurements[copyOperation], numRuns, keys.size(), [&]() { copy.reset(); }, [&]() {
+			copy.reset(new concurrent_trie_type(keys));
+			
+			return copy->size();
+		});
+	}
+	
+	measure(measurements[removeOperation], numRuns, data.hits.size(), [&]() {
+		for (const auto& key : data.keys) {
+			keys.insert(key);
+		}
+	}, [&]() {
+		for (const auto& key : data.hits) {
+			removeKey(keys, key);
+		}
+		
+		return keys.size();
+	});
+	
+	keys.synchronize();
+	
+	return results;
+}
+
+
+/* Reader scaling */
+
+struct scaling_results {
+	unsigned numReaders;
+	double lookupsPerSecond;  // across every reader
+	double writesPerSecond;
+	bool agree;  // every reader found every key
+};
+
+// Readers look up every hit passes times while one writer keeps inserting and removing misses. The writer never touches
+// a hit, so each lookup must succeed whatever it interleaves with.
+static scaling_results benchmarkReaders(concurrent_trie_type& keys, const dataset& data, unsigned numReaders, unsigned passes) {
+	std::atomic<bool> start(false);
+	std::atomic<bool> stop(false);
+	std::atomic<size_t> numFound(0);
+	std::atomic<size_t> numWrites(0);
+	
+	std::vector<std::thread> readers;
+	
+	for (unsigned i = 0; i < numReaders; i++) {
+		readers.emplace_back([&, i]() {
+			while (!start) std::this_thread::yield();
+			
+			size_t found = 0;
+			
+			for (unsigned pass = 0; pass < passes; pass++) {
+				// Each reader starts somewhere else so that they do not move through the trie in step
+				for (size_t j = 0; j < data.hits.size(); j++) {
+					found += keys.contains(data.hits[(j + i * data.hits.size() / numReaders) % data.hits.size()]);
+				}
+			}
+			
+			numFound += found;
+		});
+	}
+	
+	std::thread writer([&]() {
+		while (!start) std::this_thread::yield();
+		
+		size_t writes = 0;
+		
+		for (size_t j = 0; !stop && !data.misses.empty(); j++, writes += 2) {
+			const std::string& key = data.misses[j % data.misses.size()];
+			
+			keys.insert(key);
+			keys.remove(key);
+		}
+		
+		numWrites += writes;
+	});
+	
+	
+	auto startTime = std::chrono::steady_clock::now();
+	
+	start = true;
+	
+	for (auto& reader : readers) {
+		reader.join();
+	}
+	
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+	
+	stop = true;
+	writer.join();
+	
+	
+	scaling_results results;
+	results.numReaders = numReaders;
+	results.lookupsPerSecond = static_cast<double>(numReaders) * passes * data.hits.size() / elapsed.count();
+	results.writesPerSecond = numWrites / elapsed.count();
+	results.agree = numFound == static_cast<size_t>(numReaders) * passes * data.hits.size();
+	
+	return results;
+}
+
+// 1, 2 and 4 readers, then one per hardware thread (or maxReaders)
+static std::vector<scaling_results> benchmarkScaling(const dataset& data, const options& options) {
+	concurrent_trie_type keys;
+	
+	for (const auto& key : data.keys) {
+		keys.insert(key);
+	}
+	
+	unsigned maxReaders = options.maxReaders > 0 ? options.maxReaders : std::max(1u, std::thread::hardware_concurrency());
+	
+	std::vector<unsigned> readerCounts;
+	
+	for (unsigned numReaders : {1u, 2u, 4u, maxReaders}) {
+		if (numReaders <= std::max(4u, maxReaders) && std::find(readerCounts.begin(), readerCounts.end(), numReaders) == readerCounts.end()) readerCounts.push_back(numReaders);
+	}
+	
+	std::sort(readerCounts.begin(), readerCounts.end());
+	
+	
+	std::vector<scaling_results> allResults;
+	
+	for (unsigned numReaders : readerCounts) {
+		scaling_results best = scaling_results();
+		
+		for (unsigned run = 0; run < options.numRuns; run++) {
+			scaling_results current = benchmarkReaders(keys, data, numReaders, options.quick ? 1 : 3);
+			
+			if (run == 0 || current.lookupsPerSecond > best.lookupsPerSecond) best = current;
+			
+			if (!current.agree) best.agree = false;
+		}
+		
+		allResults.push_back(best);
+	}
+	
+	keys.synchronize();
+	
+	return allResults;
+}
+
+
+/* Reports */
+
+// Every structure that ran an operation must agree with the first one that did
+static bool check(const dataset& data, const std::vector<results>& allResults) {
+	bool agree = true;
+	
+	for (int operation = 0; operation < numOperations; operation++) {
+		const measurement* reference = nullptr;
+		
+		for (const auto& results : allResults) {
+			const measurement& current = results.measurements[operation];
+			
+			if (!current.measured) continue;
+			
+			if (!reference) {
+				reference = &current;
+			} else if (current.answer != reference->answer) {
+				std::fprintf(stderr, "%s: %s disagrees on %s (%zu instead of %zu)\n", data.name.c_str(), results.name, operationNames[operation], current.answer, reference->answer);
+				
+				agree = false;
+			}
+		}
+	}
+	
+	return agree;
+}
+
+static void report(const dataset& data, const std::vector<results>& allResults) {
+	size_t keyLength = 0;
+	
+	for (const auto& key : data.keys) {
+		keyLength += key.length();
+	}
+	
+	std::printf("%s: %zu keys of %.1f characters on average, %zu misses, %zu prefixes\n", data.name.c_str(), data.keys.size(), static_cast<double>(keyLength) / data.keys.size(), data.misses.size(), data.prefixes.size());
+	
+	std::printf("%-20s", "ns per operation");
+	
+	for (const auto& results : allResults) {
+		std::printf("%20s", results.name);
+	}
+	
+	std::printf("\n");
+	
+	
+	for (int operation = 0; operation < numOperations; operation++) {
+		std::printf("%-20s", operationNames[operation]);
+		
+		for (const auto& results : allResults) {
+			const measurement& current = results.measurements[operation];
+			
+			if (current.measured) {
+				std::printf("%20.1f", current.nanoseconds);
+			} else {
+				std::printf("%20s", "-");
+			}
+		}
+		
+		std::printf("\n");
+	}
+	
+	std::printf("%-20s", "bytes per key");
+	
+	for (const auto& results : allResults) {
+		if (results.bytes > 0) {
+			std::printf("%20.1f", static_cast<double>(results.bytes) / data.keys.size());
+		} else {
+			std::printf("%20s", "-");
+		}
+	}
+	
+	std::printf("\n\n");
+}
+
+// Returns false if a reader missed a key
+static bool reportScaling(const dataset& data, const std::vector<scaling_results>& allResults) {
+	std::printf("%s, concurrent_string_trie with one writer:\n", data.name.c_str());
+	std::printf("%-20s%20s%20s%20s\n", "readers", "lookups per second", "per reader", "writes per second");
+	
+	bool agree = true;
+	
+	for (const auto& results : allResults) {
+		std::printf("%-20u%20.0f%20.0f%20.0f\n", results.numReaders, results.lookupsPerSecond, results.lookupsPerSecond / results.numReaders, results.writesPerSecond);
+		
+		if (!results.agree) {
+			std::fprintf(stderr, "%s: concurrent_string_trie missed keys with %u readers\n", data.name.c_str(), results.numReaders);
+			
+			agree = false;
+		}
+	}
+	
+	std::printf("\n");
+	
+	return agree;
+}
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+
+// Where the trie's time and memory go. Timings above include the cost of counting.
+static void reportInstrumentation(const dataset& data, const results& trieResults) {
+	std::printf("%s, string_trie per operation:\n", data.name.c_str());
+	std::printf("%-20s%20s%20s%20s%20s\n", "", "nodes visited", "node allocations", "node frees", "system allocations");
+	
+	for (int operation = 0; operation < numOperations; operation++) {
+		const measurement& current = trieResults.measurements[operation];
+		
+		if (!current.measured) continue;
+		
+		// Per query where the operation is made of queries, otherwise per key it handles
+		double count = current.counters.queries > 0 ? current.counters.queries : (operation == moveOperation ? numMoves * 2 : data.keys.size());
+		
+		std::printf("%-20s%20.2f%20.2f%20.2f%20.4f\n", operationNames[operation], current.counters.nodesVisited / count, current.counters.nodeAllocations / count, current.counters.nodeDeallocations / count, current.counters.systemAllocations / count);
+	}
+	
+	
+	trie_type trie;
+	
+	for (const auto& key : data.keys) {
+		trie.insert(key);
+	}
+	
+	string_trie_statistics statistics = trie.statistics();
+	
+	std::printf("shape: %zu leaves (%zu ending at an inner node), %zu inner nodes (%zu node2, %zu node4, %zu node16, %zu node48, %zu node256, %zu sparse)\n", statistics.numLeaves, statistics.numTerminals, statistics.numInnerNodes, statistics.numInnerNodesOfKind[0], statistics.numInnerNodesOfKind[1], statistics.numInnerNodesOfKind[2], statistics.numInnerNodesOfKind[3], statistics.numInnerNodesOfKind[4], statistics.numInnerNodesOfKind[5]);
+	
+	std::printf("leaves by depth:");
+	
+	for (size_t depth = 0; depth < statistics.depthHistogram.size(); depth++) {
+		if (statistics.depthHistogram[depth] > 0) std::printf(" %zu:%zu", depth, statistics.depthHistogram[depth]);
+	}
+	
+	std::printf("\n");
+	
+	double numKeys = static_cast<double>(statistics.numLeaves);
+	
+	std::printf("bytes per key: %.1f in nodes, %.1f held by the node pool, %.1f in the key arena\n\n", statistics.nodeBytes / numKeys, statistics.poolBytes / numKeys, statistics.keyBytes / numKeys);
+}
+
+#endif
+
+
+/* Main */
+
+static int usage(const char* program) {
+	std::fprintf(stderr, "usage: %s [--quick] [--keys count] [--runs count] [--readers count] [--word-list path] [words] [skewed] [urls]\n", program);
+	
+	return 2;
+}
+
+int main(int argc, const char* argv[]) {
+	options options;
+	
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+		
+		if (argument == "--quick") {
+			options.quick = true;
+		} else if (argument == "--keys" && i + 1 < argc) {
+			options.numKeys = std::strtoul(argv[++i], nullptr, 10);
+		} else if (argument == "--runs" && i + 1 < argc) {
+			options.numRuns = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (argument == "--readers" && i + 1 < argc) {
+			options.maxReaders = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+		} else if (argument == "--word-list" && i + 1 < argc) {
+			options.wordList = argv[++i];
+		} else if (argument == "words" || argument == "skewed" || argument == "urls") {
+			options.datasets.push_back(argument);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	
+	if (options.quick) {
+		options.numKeys = options.numKeys > 0 ? std::min<size_t>(options.numKeys, 10000) : 10000;
+		options.numRuns = 1;
+	}
+	
+	if (options.numRuns == 0) return usage(argv[0]);
+	
+	if (options.datasets.empty()) options.datasets = {"words", "skewed", "urls"};
+	
+	
+	std::mt19937_64 random(2013);
+	
+	size_t numPrefixes = options.quick ? 1000 : 10000;
+	
+	bool agree = true;
+	
+	for (const auto& name : options.datasets) {
+		std::vector<std::string> keys;
+		size_t count = options.numKeys > 0 ? options.numKeys : 200000;
+		
+		if (name == "words") {
+			keys = loadWords(options.wordList);
+			
+			if (keys.empty()) {
+				std::fprintf(stderr, "Cannot read the word list at \"%s\".\n", options.wordList.c_str());
+				
+				return 1;
+			}
+			
+			if (options.numKeys == 0) count = keys.size();
+		} else if (name == "skewed") {
+			keys = skewedKeys(count, random);
+		} else {
+			keys = urlKeys(count, random);
+		}
+		
+		dataset data = makeDataset(name, std::move(keys), count, numPrefixes, random);
+		
+		
+		std::vector<results> allResults;
+		
+		allResults.push_back(benchmark<trie_type>("string_trie", data, options));
+		allResults.push_back(benchmarkFrozen("frozen (mapped)", data, options));
+		allResults.push_back(benchmarkConcurrent("concurrent", data, options));
+		allResults.push_back(benchmark<set_type>("std::set", data, options));
+		allResults.push_back(benchmark<unordered_set_type>("std::unordered_set", data, options));
+		
+		report(data, allResults);
+
+#ifdef STRING_TRIE_INSTRUMENTATION
+		reportInstrumentation(data, allResults.front());
+#endif
+		
+		agree = check(data, allResults) && agree;
+		
+		agree = reportScaling(data, benchmarkScaling(data, options)) && agree;
+	}
+	
+	return agree ? 0 : 1;
+}
@@ -20,10 +20,18 @@
 #import "NSString+CPPConversors.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <thread>
 #include <vector>
 #include <sstream>
 
 #include "string_trie.hpp"
+#include "concurrent_string_trie.hpp"
+#include "frozen_string_trie.hpp"
 
 
 @interface string_trieTests : XCTestCase
@@ -48,6 +56,13 @@
 	[super tearDown];
 }
 
+// wordList.txt is copied into the test bundle, so it is found wherever the repository is checked out
+- (NSString *)wordList {
+	NSString *path = [[NSBundle bundleForClass:[self class]] pathForResource:@"wordList" ofType:@"txt"];
+	
+	return path ? [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL] : nil;
+}
+
 - (void)testNSCPPConversors {
 	NSString *string = @"hello world";
 	
@@ -107,6 +122,8 @@
 	CPPAssertThrowsSpecific(self.trie->predecessor(string), std::invalid_argument, @"Finding the predecessor of a string containing the reserved character should throw an invalid_argument exception.");
 	CPPAssertThrowsSpecific(self.trie->successor(string), std::invalid_argument, @"Finding the successor of a string containing the reserved character should throw an invalid_argument exception.");
 	CPPAssertThrowsSpecific(self.trie->prefixedStrings(string), std::invalid_argument, @"Finding all strings prefixed with a string containing the reserved character should throw an invalid_argument exception.");
+	CPPAssertThrowsSpecific(self.trie->countPrefixed(string), std::invalid_argument, @"Counting the strings prefixed with a string containing the reserved character should throw an invalid_argument exception.");
+	CPPAssertThrowsSpecific(self.trie->rank(string), std::invalid_argument, @"Finding the rank of a string containing the reserved character should throw an invalid_argument exception.");
 	
 	
 	string.clear();
@@ -117,6 +134,8 @@
 	CPPAssertThrowsSpecific(self.trie->predecessor(string), std::invalid_argument, @"Finding the predecessor of an empty string should throw an invalid_argument exception.");
 	CPPAssertThrowsSpecific(self.trie->successor(string), std::invalid_argument, @"Finding the successor of an empty string should throw an invalid_argument exception.");
 	CPPAssertThrowsSpecific(self.trie->prefixedStrings(string), std::invalid_argument, @"Finding all strings prefixed with an empty string should throw an invalid_argument exception.");
+	CPPAssertThrowsSpecific(self.trie->countPrefixed(string), std::invalid_argument, @"Counting the strings prefixed with an empty string should throw an invalid_argument exception.");
+	CPPAssertThrowsSpecific(self.trie->rank(string), std::invalid_argument, @"Finding the rank of an empty string should throw an invalid_argument exception.");
 	
 	
 	string = [@"hello world" cppString];
@@ -127,6 +146,8 @@
 	CPPAssertNoThrow(self.trie->predecessor(string), @"Finding the predecessor of a valid string should not throw an exception.");
 	CPPAssertNoThrow(self.trie->successor(string), @"Finding the successor of a valid string should not throw an exception.");
 	CPPAssertNoThrow(self.trie->prefixedStrings(string), @"Finding all strings prefixed with a valid string should not throw an exception.");
+	CPPAssertNoThrow(self.trie->countPrefixed(string), @"Counting the strings prefixed with a valid string should not throw an exception.");
+	CPPAssertNoThrow(self.trie->rank(string), @"Finding the rank of a valid string should not throw an exception.");
 }
 
 - (void)testInsertRemoveContains {
@@ -198,7 +219,7 @@
 }
 
 - (void)testRealScenario {
-	NSString *wordList = [NSString stringWithContentsOfFile:@"/Users/darrenmo/Developer/Open Source/string_trie/string_trieTests/wordList.txt" encoding:NSUTF8StringEncoding error:NULL];
+	NSString *wordList = [self wordList];
 	
 	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
 	
@@ -237,7 +258,7 @@
 }
 
 - (void)testCopyAssignmentMove {
-	NSString *wordList = [NSString stringWithContentsOfFile:@"/Users/darrenmo/Developer/Open Source/string_trie/string_trieTests/wordList.txt" encoding:NSUTF8StringEncoding error:NULL];
+	NSString *wordList = [self wordList];
 	
 	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
 	
@@ -282,7 +303,7 @@
 }
 
 - (void)testIterators {
-	NSString *wordList = [NSString stringWithContentsOfFile:@"/Users/darrenmo/Developer/Open Source/string_trie/string_trieTests/wordList.txt" encoding:NSUTF8StringEncoding error:NULL];
+	NSString *wordList = [self wordList];
 	
 	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
 	
@@ -333,7 +354,7 @@
 }
 
 - (void)testPrefixes {
-	NSString *wordList = [NSString stringWithContentsOfFile:@"/Users/darrenmo/Developer/Open Source/string_trie/string_trieTests/wordList.txt" encoding:NSUTF8StringEncoding error:NULL];
+	NSString *wordList = [self wordList];
 	
 	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
 	
@@ -368,10 +389,765 @@
 	XCTAssert(returnedNumPrefixStrings == actualNumPrefixedStrings, @"Number of returned prefixed strings (%lu) does not match the number of actual prefixed strings (%lu).", returnedNumPrefixStrings, actualNumPrefixedStrings);
 }
 
+- (void)testReverseIteration {
+	NSArray *words = @[@"banana", @"apple", @"band", @"ban", @"cherry", @"bandana", @"app"];
+	
+	for (NSString *word in words) {
+		self.trie->insert([word cppString]);
+	}
+	
+	
+	using namespace std;
+	
+	vector<basic_string<unichar>> forward(self.trie->cbegin(), self.trie->cend());
+	vector<basic_string<unichar>> backward(self.trie->crbegin(), self.trie->crend());
+	
+	XCTAssert(forward.size() == [words count], @"Forward iteration returned %lu strings instead of %lu.", forward.size(), [words count]);
+	XCTAssert(is_sorted(forward.begin(), forward.end()), @"Forward iteration not in sorted order.");
+	XCTAssert(equal(forward.rbegin(), forward.rend(), backward.begin(), backward.end()), @"Reverse iteration does not mirror forward iteration.");
+	
+	
+	auto last = self.trie->cend();
+	--last;
+	
+	XCTAssert([[NSString stringWithCPPString:*last] isEqualToString:@"cherry"], @"Decrementing the end iterator gave \"%@\" instead of \"cherry\".", [NSString stringWithCPPString:*last]);
+	
+	auto first = self.trie->cbegin();
+	--first;
+	
+	XCTAssert(first == self.trie->cend(), @"Decrementing the begin iterator did not give the end iterator.");
+	
+	++first;
+	
+	XCTAssert(first == self.trie->cbegin(), @"Incrementing the end iterator did not give the begin iterator.");
+	XCTAssert(self.trie->crbegin().base() == self.trie->cend(), @"The reverse begin iterator's base is not the end iterator.");
+	XCTAssert(self.trie->crend().base() == self.trie->cbegin(), @"The reverse end iterator's base is not the begin iterator.");
+}
+
+- (void)testPredecessorSuccessor {
+	NSArray *words = @[@"hello", @"help", @"hex", @"heck", @"he"];
+	
+	for (NSString *word in words) {
+		self.trie->insert([word cppString]);
+	}
+	
+	
+	NSDictionary *successors = @{@"a": @"he", @"he": @"heck", @"hel": @"hello", @"hello": @"help", @"helq": @"hex", @"hey": @""};
+	
+	for (NSString *string in successors) {
+		auto successor = self.trie->successor([string cppString]);
+		NSString *result = successor == self.trie->cend() ? @"" : [NSString stringWithCPPString:*successor];
+		
+		XCTAssert([result isEqualToString:successors[string]], @"Successor of \"%@\" is \"%@\" instead of \"%@\".", string, result, successors[string]);
+	}
+	
+	NSDictionary *predecessors = @{@"a": @"", @"he": @"", @"hel": @"heck", @"help": @"hello", @"hez": @"hex", @"z": @"hex"};
+	
+	for (NSString *string in predecessors) {
+		auto predecessor = self.trie->predecessor([string cppString]);
+		NSString *result = predecessor == self.trie->cend() ? @"" : [NSString stringWithCPPString:*predecessor];
+		
+		XCTAssert([result isEqualToString:predecessors[string]], @"Predecessor of \"%@\" is \"%@\" instead of \"%@\".", string, result, predecessors[string]);
+	}
+	
+	
+	// Walking on from a successor continues in order
+	size_t count = 0;
+	
+	for (auto i = self.trie->successor([@"he" cppString]); i != self.trie->cend(); ++i) {
+		count++;
+	}
+	
+	XCTAssert(count == [words count] - 1, @"Iterating from the successor of \"he\" visited %lu strings instead of %lu.", count, [words count] - 1);
+	
+	
+	size_t numPrefixed = 0;
+	
+	for (auto string : self.trie->prefixedStrings([@"hel" cppString])) {
+		XCTAssert([[NSString stringWithCPPString:string] hasPrefix:@"hel"], @"\"%@\" does not start with \"hel\".", [NSString stringWithCPPString:string]);
+		
+		numPrefixed++;
+	}
+	
+	XCTAssert(numPrefixed == 2, @"Found %lu strings prefixed by \"hel\" instead of 2.", numPrefixed);
+}
+
+- (void)testRankSelect {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		self.trie->insert([word cppString]);
+	}];
+	
+	// Remove some words so that the counts are also kept up to date on the way out
+	__block NSUInteger lineNumber = 0;
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		if (lineNumber++ % 3 == 0) self.trie->remove([word cppString]);
+	}];
+	
+	
+	using namespace std;
+	
+	vector<basic_string<unichar>> strings(self.trie->cbegin(), self.trie->cend());
+	
+	for (size_t i = 0; i < strings.size(); i += 7) {
+		auto selected = self.trie->select(i);
+		
+		XCTAssert(selected != self.trie->cend() && basic_string<unichar>(*selected) == strings[i], @"Selecting string %lu did not give \"%@\".", i, [NSString stringWithCPPString:strings[i]]);
+		XCTAssert(self.trie->rank(strings[i]) == i, @"Rank of \"%@\" is %lu instead of %lu.", [NSString stringWithCPPString:strings[i]], self.trie->rank(strings[i]), i);
+	}
+	
+	XCTAssert(self.trie->select(strings.size()) == self.trie->cend(), @"Selecting past the last string did not give the end iterator.");
+	
+	
+	for (NSString *prefix in @[@"a", @"hec", @"pre", @"un", @"zz", @"qqq"]) {
+		basic_string<unichar> cppPrefix = [prefix cppString];
+		
+		auto first = lower_bound(strings.begin(), strings.end(), cppPrefix);
+		auto last = find_if(first, strings.end(), [&cppPrefix](const basic_string<unichar>& string) {
+			return string.compare(0, cppPrefix.length(), cppPrefix) != 0;
+		});
+		
+		size_t expectedRank = first - strings.begin();
+		size_t expectedNumPrefixed = last - first;
+		
+		size_t rank = self.trie->rank(cppPrefix);
+		size_t numPrefixed = self.trie->countPrefixed(cppPrefix);
+		
+		XCTAssert(rank == expectedRank, @"Rank of \"%@\" is %lu instead of %lu.", prefix, rank, expectedRank);
+		XCTAssert(numPrefixed == expectedNumPrefixed, @"Counted %lu strings prefixed by \"%@\" instead of %lu.", numPrefixed, prefix, expectedNumPrefixed);
+		
+		// The last page of the prefix ends where prefixedStrings() does
+		if (numPrefixed > 0) {
+			auto lastPrefixed = self.trie->select(rank + numPrefixed - 1);
+			
+			XCTAssert(++lastPrefixed == self.trie->prefixedStrings(cppPrefix).end(), @"The last string prefixed by \"%@\" is not the last of prefixedStrings().", prefix);
+		}
+	}
+}
+
+- (void)testRankSelectWideNodes {
+	// Byte-sized characters fill a node48 and then a node256, which keep their own leaf counts
+	using namespace std;
+	
+	string_trie<char, '\n'> trie;
+	vector<string> strings;
+	
+	for (int i = 0; i < 255; i++) {
+		string first(1, static_cast<char>(1 + (i * 7) % 255));
+		
+		if (first[0] == '\n') continue;
+		
+		for (const char* suffix : {"", "a", "b"}) {
+			strings.push_back(first + suffix);
+			
+			trie.insert(strings.back());
+		}
+		
+		if (i == 20 || i == 100) trie.verifyStructure();
+	}
+	
+	trie.verifyStructure();
+	
+	
+	// Remove some strings so that the counts are also kept up to date on the way out
+	for (size_t i = 0; i < strings.size(); i += 4) {
+		trie.remove(strings[i]);
+	}
+	
+	trie.verifyStructure();
+	
+	vector<string> remaining(trie.cbegin(), trie.cend());
+	
+	for (size_t i = 0; i < remaining.size(); i++) {
+		auto selected = trie.select(i);
+		
+		XCTAssert(selected != trie.cend() && string(*selected) == remaining[i], @"Selecting string %lu did not give the expected string.", i);
+		XCTAssert(trie.rank(remaining[i]) == i, @"Rank of string %lu is %lu.", i, trie.rank(remaining[i]));
+	}
+	
+	XCTAssert(trie.select(remaining.size()) == trie.cend(), @"Selecting past the last string did not give the end iterator.");
+}
+
+- (void)testBulkLoad {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	using namespace std;
+	
+	vector<basic_string<unichar>> words;
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		self.trie->insert([word cppString]);
+		
+		words.push_back([word cppString]);
+	}];
+	
+	sort(words.begin(), words.end());
+	
+	
+	for (unsigned numThreads : {1u, 4u}) {
+		string_trie<unichar, '\n'> trie(words.begin(), words.end(), numThreads);
+		
+		XCTAssert(trie.size() == self.trie->size(), @"Bulk loaded trie with %u threads has %lu strings instead of %lu.", numThreads, trie.size(), self.trie->size());
+		XCTAssert(equal(trie.cbegin(), trie.cend(), self.trie->cbegin(), self.trie->cend()), @"Bulk loaded trie with %u threads differs from inserted trie.", numThreads);
+		
+		// The result must behave like any other trie
+		trie.remove(words.front());
+		trie.insert([@"zzz" cppString]);
+		
+		XCTAssert(!trie.contains(words.front()) && trie.contains([@"zzz" cppString]), @"Bulk loaded trie with %u threads not modifiable.", numThreads);
+	}
+	
+	
+	swap(words.front(), words.back());
+	
+	XCTAssertThrows((string_trie<unichar, '\n'>(words.begin(), words.end())), @"Unsorted strings not rejected.");
+	
+	self.trie->assignSorted(words.begin(), words.begin());
+	
+	XCTAssert(self.trie->empty(), @"Trie not empty after assigning no strings.");
+}
+
+- (void)testFrozenRoundTrip {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	NSMutableArray *words = [NSMutableArray array];
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		self.trie->insert([word cppString]);
+		
+		[words addObject:word];
+	}];
+	
+	
+	using namespace std;
+	
+	string path = [[NSTemporaryDirectory() stringByAppendingPathComponent:@"string_trieTests.frozen"] fileSystemRepresentation];
+	
+	self.trie->freeze().save(path);
+	
+	auto frozen = frozen_string_trie<unichar, '\n'>::open(path);
+	
+	XCTAssert(frozen.size() == self.trie->size(), @"Frozen trie has %lu strings instead of %lu.", frozen.size(), self.trie->size());
+	XCTAssert(equal(frozen.cbegin(), frozen.cend(), self.trie->cbegin(), self.trie->cend()), @"Frozen trie iterates differently from the trie it was frozen from.");
+	
+	
+	// Each word, and the same word cut short and extended, exercises every kind of search
+	for (NSString *word in words) {
+		for (NSString *string in @[word, [word substringToIndex:([word length] + 1) / 2], [word stringByAppendingString:@"q"]]) {
+			basic_string<unichar> cppString = [string cppString];
+			
+			XCTAssert(frozen.contains(cppString) == self.trie->contains(cppString), @"Frozen trie disagrees on containing \"%@\".", string);
+			
+			auto frozenSuccessor = frozen.successor(cppString);
+			auto successor = self.trie->successor(cppString);
+			
+			XCTAssert(frozenSuccessor == frozen.cend() ? successor == self.trie->cend() : (successor != self.trie->cend() && *frozenSuccessor == *successor), @"Frozen trie disagrees on the successor of \"%@\".", string);
+			
+			auto frozenPredecessor = frozen.predecessor(cppString);
+			auto predecessor = self.trie->predecessor(cppString);
+			
+			XCTAssert(frozenPredecessor == frozen.cend() ? predecessor == self.trie->cend() : (predecessor != self.trie->cend() && *frozenPredecessor == *predecessor), @"Frozen trie disagrees on the predecessor of \"%@\".", string);
+			
+			auto frozenPrefixed = frozen.prefixedStrings(cppString);
+			auto prefixed = self.trie->prefixedStrings(cppString);
+			
+			XCTAssert(equal(frozenPrefixed.begin(), frozenPrefixed.end(), prefixed.begin(), prefixed.end()), @"Frozen trie disagrees on the strings prefixed by \"%@\".", string);
+		}
+	}
+	
+	
+	ofstream([[NSTemporaryDirectory() stringByAppendingPathComponent:@"string_trieTests.invalid"] fileSystemRepresentation]) << "not a trie";
+	
+	XCTAssertThrows((frozen_string_trie<unichar, '\n'>::open([[NSTemporaryDirectory() stringByAppendingPathComponent:@"string_trieTests.invalid"] fileSystemRepresentation])), @"Invalid file not rejected.");
+	XCTAssertThrows((frozen_string_trie<char, '\n'>::open(path)), @"File of a different character type not rejected.");
+}
+
+- (void)testFrozenCorruptImage {
+	for (NSString *string in @[@"a", @"ab", @"abc", @"abd", @"b", @"ba", @"bb"]) {
+		self.trie->insert([string cppString]);
+	}
+	
+	
+	using namespace std;
+	
+	string path = [[NSTemporaryDirectory() stringByAppendingPathComponent:@"string_trieTests.corrupt"] fileSystemRepresentation];
+	
+	self.trie->freeze().save(path);
+	
+	ifstream file(path, ios::binary);
+	vector<char> image((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	
+	
+	// The header is 64 bytes and each section starts on an 8-byte boundary: nodes of five 32-bit fields, child
+	// references, child characters, key offsets, then keys
+	auto read64 = [&image](size_t offset) {
+		uint64_t value;
+		memcpy(&value, image.data() + offset, sizeof(value));
+		
+		return value;
+	};
+	
+	auto roundUp = [](size_t size) {
+		return (size + 7) & ~size_t(7);
+	};
+	
+	uint64_t numNodes = read64(32);
+	uint64_t numChildren = read64(40);
+	
+	size_t nodes = 64;
+	size_t children = roundUp(nodes + numNodes * 20);
+	size_t characters = roundUp(children + numChildren * 4);
+	size_t keyOffsets = roundUp(characters + numChildren * sizeof(unichar));
+	
+	XCTAssert(numNodes >= 2 && image.size() > keyOffsets + 16, @"Frozen image is laid out differently than expected.");
+	
+	
+	CPPAssertNoThrow((frozen_string_trie<unichar, '\n'>::open(path)), @"Intact image rejected.");
+	
+	// Each corruption must be caught when the file is opened, not when a lookup runs into it
+	auto opensWith = [&](size_t offset, auto value) {
+		vector<char> corrupt = image;
+		memcpy(corrupt.data() + offset, &value, sizeof(value));
+		
+		ofstream(path, ios::binary | ios::trunc).write(corrupt.data(), corrupt.size());
+		
+		try {
+			frozen_string_trie<unichar, '\n'>::open(path);
+		} catch (const runtime_error&) {
+			return false;
+		}
+		
+		return true;
+	};
+	
+	uint32_t huge = 0x7fffffff;
+	
+	XCTAssert(!opensWith(nodes + 4, huge), @"Children past the end of the child references not rejected.");
+	XCTAssert(!opensWith(nodes + 8, uint32_t(0)), @"Node without children not rejected.");
+	XCTAssert(!opensWith(nodes + 12, huge), @"First leaf past the end not rejected.");
+	XCTAssert(!opensWith(nodes + 16, huge), @"End leaf past the end not rejected.");
+	XCTAssert(!opensWith(nodes + 20, huge), @"Compare index past the end of the keys not rejected.");
+	XCTAssert(!opensWith(children, huge), @"Child reference past the end of the nodes not rejected.");
+	XCTAssert(!opensWith(children, uint32_t(0)), @"Child reference back to the root not rejected.");
+	XCTAssert(!opensWith(characters + sizeof(unichar), unichar('a')), @"Unordered child characters not rejected.");
+	XCTAssert(!opensWith(keyOffsets + 8, uint64_t(0)), @"Key offsets that do not increase not rejected.");
+}
+
+- (void)testBatchLookup {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	__block std::vector<std::basic_string<unichar>> strings;
+	
+	// Every other word goes into the trie; the rest, and the words cut short and extended, are looked up as misses
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		if (strings.size() % 8 == 0) self.trie->insert([word cppString]);
+		
+		strings.push_back([word cppString]);
+		strings.push_back([[word substringToIndex:([word length] + 1) / 2] cppString]);
+		strings.push_back([[word stringByAppendingString:@"q"] cppString]);
+		strings.push_back([[word stringByAppendingString:@"~"] cppString]);
+	}];
+	
+	
+	using namespace std;
+	
+	vector<basic_string_view<unichar>> views(strings.begin(), strings.end());
+	
+	for (unsigned numThreads : {1u, 4u}) {
+		unique_ptr<bool[]> found(new bool[views.size()]);
+		vector<string_trie<unichar, '\n'>::const_iterator> successors(views.size());
+		
+		self.trie->containsBatch(views.data(), views.size(), found.get(), numThreads);
+		self.trie->successorBatch(views.data(), views.size(), successors.data(), numThreads);
+		
+		for (size_t i = 0; i < strings.size(); i++) {
+			XCTAssert(found[i] == self.trie->contains(strings[i]), @"containsBatch() disagrees with contains() on \"%@\".", [NSString stringWithCPPString:strings[i]]);
+			XCTAssert(successors[i] == self.trie->successor(strings[i]), @"successorBatch() disagrees with successor() on \"%@\".", [NSString stringWithCPPString:strings[i]]);
+		}
+	}
+	
+	basic_string<unichar> invalidString = [@"a\nb" cppString];
+	basic_string_view<unichar> invalidViews[] = {views[0], invalidString};
+	bool found[2];
+	
+	XCTAssertThrows(self.trie->containsBatch(invalidViews, 2, found), @"Invalid string in a batch not rejected.");
+	
+	
+	// Against one contains() call at a time
+	unique_ptr<bool[]> batchFound(new bool[views.size()]);
+	
+	clock_t startTime = clock();
+	
+	for (const auto& string : strings) {
+		self.trie->contains(string);
+	}
+	
+	clock_t loopTime = clock() - startTime;
+	
+	startTime = clock();
+	
+	self.trie->containsBatch(views.data(), views.size(), batchFound.get());
+	
+	clock_t batchTime = clock() - startTime;
+	
+	NSLog(@"%lu lookups: %.1f ms one at a time, %.1f ms batched", strings.size(), loopTime * 1000.0 / CLOCKS_PER_SEC, batchTime * 1000.0 / CLOCKS_PER_SEC);
+}
+
+- (void)testBinaryKeys {
+	using namespace std;
+	
+	const unichar nul = 0;
+	const unichar newline = '\n';
+	
+	vector<basic_string<unichar>> strings = {basic_string<unichar>(), basic_string<unichar>(1, nul), basic_string<unichar>(2, nul), [@"a\nb" cppString], [@"a" cppString], [@"ab" cppString], basic_string<unichar>(1, newline)};
+	
+	binary_string_trie<unichar> trie;
+	
+	for (const auto& string : strings) {
+		trie.insert(string);
+	}
+	
+	set<basic_string<unichar>> expected(strings.begin(), strings.end());
+	
+	XCTAssert(trie.size() == expected.size(), @"Binary trie has %lu strings instead of %lu.", trie.size(), expected.size());
+	XCTAssert(equal(trie.cbegin(), trie.cend(), expected.begin(), expected.end()), @"Binary trie is not in basic_string order.");
+	
+	for (const auto& string : strings) {
+		XCTAssert(trie.contains(basic_string_view<unichar>(string)), @"Binary trie does not contain \"%@\".", [NSString stringWithCPPString:string]);
+	}
+	
+	XCTAssert(*trie.cbegin() == basic_string<unichar>(), @"The empty string does not come first.");
+	XCTAssert(*trie.successor(basic_string<unichar>()) == basic_string<unichar>(1, nul), @"Successor of the empty string is wrong.");
+	XCTAssert(trie.predecessor(basic_string<unichar>()) == trie.cend(), @"The empty string has a predecessor.");
+	XCTAssert(distance(trie.prefixedStrings([@"a" cppString]).begin(), trie.prefixedStrings([@"a" cppString]).end()) == 3, @"Wrong number of strings prefixed by \"a\".");
+	
+	
+	// "a" ends where "a\nb" and "ab" branch off, so removing it leaves a node with no key of its own
+	trie.remove([@"a" cppString]);
+	trie.remove(basic_string<unichar>());
+	
+	expected.erase([@"a" cppString]);
+	expected.erase(basic_string<unichar>());
+	
+	XCTAssert(!trie.contains([@"a" cppString]) && !trie.contains(basic_string<unichar>()), @"Removed strings are still found.");
+	XCTAssert(equal(trie.cbegin(), trie.cend(), expected.begin(), expected.end()), @"Binary trie is out of order after removal.");
+	XCTAssert(equal(trie.crbegin(), trie.crend(), expected.rbegin(), expected.rend()), @"Binary trie is out of order when reversed.");
+	
+	
+	// The concurrent trie keeps terminal leaves the same way
+	binary_concurrent_string_trie<unichar> concurrentTrie;
+	
+	for (const auto& string : strings) {
+		concurrentTrie.insert(string);
+	}
+	
+	{
+		auto snapshot = concurrentTrie.read();
+		
+		XCTAssert(concurrentTrie.size() == strings.size(), @"Binary concurrent trie has %lu strings instead of %lu.", concurrentTrie.size(), strings.size());
+		XCTAssert(*snapshot.cbegin() == basic_string<unichar>(), @"The empty string does not come first in the concurrent trie.");
+		XCTAssert(*snapshot.successor(basic_string<unichar>()) == basic_string<unichar>(1, nul), @"Successor of the empty string is wrong in the concurrent trie.");
+		XCTAssert(snapshot.predecessor(basic_string<unichar>()) == snapshot.cend(), @"The empty string has a predecessor in the concurrent trie.");
+		XCTAssert(distance(snapshot.prefixedStrings([@"a" cppString]).begin(), snapshot.prefixedStrings([@"a" cppString]).end()) == 3, @"Wrong number of strings prefixed by \"a\" in the concurrent trie.");
+	}
+	
+	concurrentTrie.remove([@"a" cppString]);
+	concurrentTrie.remove(basic_string<unichar>());
+	
+	{
+		auto snapshot = concurrentTrie.read();
+		
+		XCTAssert(!snapshot.contains([@"a" cppString]) && !snapshot.contains(basic_string<unichar>()), @"Removed strings are still found in the concurrent trie.");
+		XCTAssert(equal(snapshot.cbegin(), snapshot.cend(), expected.begin(), expected.end()), @"Binary concurrent trie is out of order after removal.");
+		XCTAssert(equal(snapshot.crbegin(), snapshot.crend(), expected.rbegin(), expected.rend()), @"Binary concurrent trie is out of order when reversed.");
+	}
+	
+	
+	// The default trie still rejects what a binary trie accepts
+	XCTAssertThrows(self.trie->insert(basic_string<unichar>()), @"Empty string not rejected.");
+	XCTAssertThrows(self.trie->insert(strings[3]), @"String containing the reserved character not rejected.");
+}
+
+- (void)testOverlongKey {
+	using namespace std;
+	
+	// Strings of 2^32 characters are too big to make, so lower the limit to reach it with real strings
+	size_t previousLimit = binary_string_trie<unichar>::setMaximumKeyLength(8);
+	
+	basic_string<unichar> longest = [@"abcdefgh" cppString];
+	basic_string<unichar> overlong = [@"abcdefghi" cppString];
+	
+	binary_string_trie<unichar> trie;
+	
+	CPPAssertNoThrow(trie.insert(longest), @"Inserting a string as long as the limit should not throw an exception.");
+	CPPAssertThrowsSpecific(trie.insert(overlong), std::length_error, @"Inserting a string too long for a leaf should throw a length_error exception.");
+	XCTAssert(trie.size() == 1, @"Trie changed when an insertion was rejected.");
+	
+	vector<basic_string<unichar>> sorted = {longest, overlong};
+	
+	CPPAssertThrowsSpecific((binary_string_trie<unichar>(sorted.begin(), sorted.end())), std::length_error, @"Bulk loading a string too long for a leaf should throw a length_error exception.");
+	
+	binary_string_trie<unichar>::setMaximumKeyLength(previousLimit);
+}
+
+- (void)testConcurrentCopyIsShared {
+	concurrent_string_trie<unichar, '\n'> trie;
+	
+	trie.insert([@"alpha" cppString]);
+	trie.insert([@"beta" cppString]);
+	
+	concurrent_string_trie<unichar, '\n'> copy = trie;
+	
+	trie.remove([@"alpha" cppString]);
+	trie.insert([@"gamma" cppString]);
+	
+	XCTAssert(copy.size() == 2 && copy.contains([@"alpha" cppString]) && !copy.contains([@"gamma" cppString]), @"Copy changed with the original.");
+	XCTAssert(trie.size() == 2 && !trie.contains([@"alpha" cppString]) && trie.contains([@"gamma" cppString]), @"Original not changed.");
+	
+	
+	// A snapshot keeps seeing the trie as it was
+	auto snapshot = trie.read();
+	
+	trie.clear();
+	
+	XCTAssert(snapshot.contains([@"beta" cppString]) && snapshot.contains([@"gamma" cppString]), @"Snapshot changed after clear().");
+	XCTAssert(trie.empty(), @"Trie not empty after clear().");
+}
+
+- (void)testConcurrentReadersWithWriter {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	__block std::set<std::basic_string<unichar>> uniqueWords;
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		uniqueWords.insert([word cppString]);
+	}];
+	
+	
+	using namespace std;
+	
+	// Every other word stays in the trie; the writer keeps removing and reinserting the rest
+	vector<basic_string<unichar>> stableWords, churnWords;
+	
+	for (const auto& word : uniqueWords) {
+		(stableWords.size() == churnWords.size() ? stableWords : churnWords).push_back(word);
+	}
+	
+	concurrent_string_trie<unichar, '\n'> trie;
+	
+	for (const auto& word : uniqueWords) {
+		trie.insert(word);
+	}
+	
+	
+	atomic<bool> stop(false);
+	atomic<size_t> numMissing(0), numUnsorted(0);
+	
+	vector<thread> readers;
+	
+	for (unsigned i = 0; i < 4; i++) {
+		readers.emplace_back([&, i] {
+			for (size_t j = i; !stop; j += 7) {
+				if (!trie.contains(stableWords[j % stableWords.size()])) {
+					numMissing++;
+				}
+				
+				if (j % 1000 == i) {
+					auto snapshot = trie.read();
+					
+					if (!is_sorted(snapshot.cbegin(), snapshot.cend())) {
+						numUnsorted++;
+					}
+				}
+			}
+		});
+	}
+	
+	for (unsigned round = 0; round < 3; round++) {
+		for (const auto& word : churnWords) {
+			trie.remove(word);
+		}
+		
+		for (const auto& word : churnWords) {
+			trie.insert(word);
+		}
+	}
+	
+	stop = true;
+	
+	for (auto& reader : readers) {
+		reader.join();
+	}
+	
+	
+	XCTAssert(numMissing == 0, @"Readers missed %lu stable words.", (size_t)numMissing);
+	XCTAssert(numUnsorted == 0, @"Readers saw %lu unsorted snapshots.", (size_t)numUnsorted);
+	XCTAssert(trie.size() == uniqueWords.size(), @"Trie has %lu strings instead of %lu.", trie.size(), uniqueWords.size());
+	
+	trie.synchronize();
+}
+
+- (void)testConcurrentReaderScaling {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	__block std::vector<std::basic_string<unichar>> words;
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		words.push_back([word cppString]);
+	}];
+	
+	
+	using namespace std;
+	
+	concurrent_string_trie<unichar, '\n'> trie;
+	
+	for (const auto& word : words) {
+		trie.insert(word);
+	}
+	
+	// Lookup throughput with a writer replacing words the whole time
+	for (unsigned numReaders = 1; numReaders <= max(2u, thread::hardware_concurrency()); numReaders *= 2) {
+		atomic<bool> stop(false);
+		atomic<size_t> numLookups(0);
+		
+		vector<thread> readers;
+		
+		for (unsigned i = 0; i < numReaders; i++) {
+			readers.emplace_back([&, i] {
+				size_t count = 0;
+				
+				for (size_t j = i; !stop; j += 7, count++) {
+					trie.contains(words[j % words.size()]);
+				}
+				
+				numLookups += count;
+			});
+		}
+		
+		thread writer([&] {
+			for (size_t j = 0; !stop; j += 13) {
+				trie.remove(words[j % words.size()]);
+				trie.insert(words[j % words.size()]);
+			}
+		});
+		
+		this_thread::sleep_for(chrono::milliseconds(500));
+		
+		stop = true;
+		
+		for (auto& reader : readers) {
+			reader.join();
+		}
+		
+		writer.join();
+		
+		NSLog(@"%u readers: %.2f million lookups per second", numReaders, numLookups * 2 / 1e6);
+	}
+	
+	XCTAssert(trie.size() == set<basic_string<unichar>>(words.begin(), words.end()).size(), @"Writer lost strings.");
+}
+
+- (void)testFanOut {
+	// Enough distinct first characters to walk a node through every kind and back
+	const unichar numCharacters = 600;
+	
+	std::vector<std::basic_string<unichar>> strings;
+	
+	for (unichar i = 0; i < numCharacters; i++) {
+		std::basic_string<unichar> string = [@"fan out" cppString];
+		string[0] = 'A' + (i * 7) % numCharacters;
+		
+		strings.push_back(string);
+		
+		self.trie->insert(string);
+		self.trie->verifyStructure();
+	}
+	
+	XCTAssert(self.trie->size() == numCharacters, @"Size (%lu) not equal to number of inserted strings (%u).", self.trie->size(), numCharacters);
+	
+	for (const auto& string : strings) {
+		XCTAssert(self.trie->contains(string), @"contains(\"%@\") returned false even after \"%@\" was inserted.", [NSString stringWithCPPString:string], [NSString stringWithCPPString:string]);
+	}
+	
+	
+	std::vector<std::basic_string<unichar>> sortedStrings(strings);
+	std::sort(sortedStrings.begin(), sortedStrings.end());
+	
+	std::vector<std::basic_string<unichar>> iteratedStrings;
+	std::copy(self.trie->cbegin(), self.trie->cend(), std::back_inserter(iteratedStrings));
+	
+	XCTAssert(iteratedStrings == sortedStrings, @"Strings were not iterated in order.");
+	
+	
+	for (size_t i = 0; i < strings.size(); i++) {
+		self.trie->remove(strings[i]);
+		self.trie->verifyStructure();
+		
+		XCTAssertFalse(self.trie->contains(strings[i]), @"contains(\"%@\") returned true even after \"%@\" was removed.", [NSString stringWithCPPString:strings[i]], [NSString stringWithCPPString:strings[i]]);
+	}
+	
+	XCTAssert(self.trie->empty(), @"Trie not empty after removing every string.");
+}
+
+- (void)testMemoryUsage {
+	NSString *wordList = [self wordList];
+	
+	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
+	
+	NSMutableSet *words = [NSMutableSet set];
+	
+	__block size_t keyBytes = 0;
+	
+	[wordList enumerateLinesUsingBlock:^(NSString *word, BOOL *stop) {
+		self.trie->insert([word cppString]);
+		
+		if (![words containsObject:word]) keyBytes += [word length] * sizeof(unichar);
+		
+		[words addObject:word];
+	}];
+	
+	
+	size_t memoryUsage = self.trie->memoryUsage();
+	
+	NSLog(@"%lu keys (%lu bytes) take %lu bytes", self.trie->size(), keyBytes, memoryUsage);
+	
+	XCTAssert(memoryUsage > keyBytes, @"Memory usage (%lu bytes) is less than the size of the keys (%lu bytes).", memoryUsage, keyBytes);
+	XCTAssert(memoryUsage < 128 * self.trie->size(), @"Memory usage (%lu bytes) is more than 128 bytes per key.", memoryUsage);
+	
+	
+	// Removing keys leaves garbage in the key arena until it is compacted
+	for (NSString *word in words) {
+		if (arc4random_uniform(4) != 0) self.trie->remove([word cppString]);
+	}
+	
+	self.trie->verifyStructure();
+	
+	XCTAssert(self.trie->memoryUsage() <= memoryUsage, @"Memory usage grew from %lu to %lu bytes after removing strings.", memoryUsage, self.trie->memoryUsage());
+	
+	
+	self.trie->clear();
+	
+	XCTAssert(self.trie->memoryUsage() == sizeof(*self.trie), @"Memory usage (%lu bytes) not released by clear().", self.trie->memoryUsage());
+}
+
 /* NSSet (hash table) will generally be faster than a trie, so this test will almost always fail.
  */
 //- (void)testSpeed {
-//	NSString *wordList = [NSString stringWithContentsOfFile:@"/Users/darrenmo/Developer/Open Source/string_trie/string_trieTests/wordList.txt" encoding:NSUTF8StringEncoding error:NULL];
+//	NSString *wordList = [self wordList];
 //	
 //	XCTAssert([wordList length] > 0, @"Word list not being loaded.");
 //	